@@ -0,0 +1,575 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+
+#include <unistd.h>
+
+#include <masiina/compiler/unit.hpp>
+#include <masiina/runtime/environment.hpp>
+#include <masiina/runtime/parser.hpp>
+#include <masiina/runtime/timer_wheel.hpp>
+#include <masiina/version.hpp>
+#include <peelo/unicode/encoding/utf8.hpp>
+
+#if !defined(MASIINA_BENCH_CORPUS_DIR)
+# define MASIINA_BENCH_CORPUS_DIR "corpus"
+#endif
+
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * Single iteration of an benchmark. Performs whatever setup it needs and
+ * returns the time spent in the part that is being measured, along with
+ * number of items processed, such as routine steps, if that is meaningful
+ * for the benchmark.
+ */
+struct measurement
+{
+  std::chrono::nanoseconds elapsed;
+  std::size_t items;
+};
+
+using benchmark_function = std::function<std::optional<measurement>()>;
+
+struct result
+{
+  std::string name;
+  std::size_t iterations;
+  std::chrono::nanoseconds min;
+  std::chrono::nanoseconds median;
+  std::chrono::nanoseconds mean;
+  std::size_t items;
+};
+
+// Programs which are used as input for the benchmarks, relative to the corpus
+// directory. The library module is used only for benchmarking imports, as it
+// consists of word declarations only.
+static const char* programs[] =
+{
+  "arrays.plorth",
+  "channels.plorth",
+  "fib.plorth",
+  "loops.plorth",
+  "routines.plorth",
+  "strings.plorth",
+};
+static const char* library = "library.plorth";
+
+static std::string corpus_dir = MASIINA_BENCH_CORPUS_DIR;
+static std::size_t iteration_count = 20;
+static std::string filter;
+
+static void
+print_usage(const char* executable)
+{
+  std::cerr
+    << std::endl
+    << "Usage: "
+    << executable
+    << " [switches]"
+    << std::endl
+    << "  -c <dir>  Directory which contains the benchmark corpus." << std::endl
+    << "  -n <n>    Run each benchmark <n> times. Default is 20." << std::endl
+    << "  -f <text> Run only benchmarks whose name contains <text>."
+    << std::endl
+    << "  --help    Display this message." << std::endl;
+}
+
+static void
+scan_arguments(int argc, char** argv)
+{
+  for (int offset = 1; offset < argc; ++offset)
+  {
+    const std::string arg = argv[offset];
+
+    if (arg == "--help" || arg == "-h")
+    {
+      print_usage(argv[0]);
+      std::exit(EXIT_SUCCESS);
+    }
+    else if ((arg == "-c" || arg == "-n" || arg == "-f") && offset + 1 < argc)
+    {
+      const char* value = argv[++offset];
+
+      if (arg == "-c")
+      {
+        corpus_dir = value;
+      }
+      else if (arg == "-f")
+      {
+        filter = value;
+      }
+      else if (!(iteration_count = std::strtoul(value, nullptr, 10)))
+      {
+        std::cerr << "Invalid iteration count: " << value << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+    } else {
+      std::cerr << "Unrecognized switch: " << arg << std::endl;
+      print_usage(argv[0]);
+      std::exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/**
+ * Compiles given source files into an temporary file, optionally
+ * compressed, and returns path of the file, or nothing if the compilation
+ * fails.
+ */
+static std::optional<std::string>
+compile_to_file(const std::vector<std::string>& paths, bool compress = false)
+{
+  char path[] = "/tmp/masiina-bench-XXXXXX";
+  masiina::compiler::unit unit;
+  FILE* output;
+  int fd;
+
+  unit.compress(compress);
+
+  for (const auto& source_path : paths)
+  {
+    if (const auto error = unit.compile_file(source_path))
+    {
+      std::cerr << *error << std::endl;
+
+      return std::nullopt;
+    }
+  }
+  if ((fd = ::mkstemp(path)) < 0 || !(output = ::fdopen(fd, "wb")))
+  {
+    std::cerr << "Unable to create temporary file." << std::endl;
+
+    return std::nullopt;
+  }
+  if (const auto error = unit.write(output))
+  {
+    std::cerr << *error << std::endl;
+    std::fclose(output);
+
+    return std::nullopt;
+  }
+  std::fclose(output);
+
+  return path;
+}
+
+static std::optional<measurement>
+benchmark_compile(const std::string& path)
+{
+  masiina::compiler::unit unit;
+  const auto start = clock_type::now();
+
+  if (const auto error = unit.compile_file(path))
+  {
+    std::cerr << *error << std::endl;
+
+    return std::nullopt;
+  }
+
+  return measurement{ clock_type::now() - start, 0 };
+}
+
+static std::optional<measurement>
+benchmark_write(const masiina::compiler::unit& compiled_unit)
+{
+  // Writing populates the symbol table of the unit, so each iteration
+  // writes an fresh copy of it.
+  masiina::compiler::unit unit(compiled_unit);
+  FILE* output = std::tmpfile();
+
+  if (!output)
+  {
+    return std::nullopt;
+  }
+
+  const auto start = clock_type::now();
+
+  const auto error = unit.write(output);
+  const auto elapsed = clock_type::now() - start;
+
+  std::fclose(output);
+  if (error)
+  {
+    std::cerr << *error << std::endl;
+
+    return std::nullopt;
+  }
+
+  return measurement{ elapsed, 0 };
+}
+
+static std::optional<measurement>
+benchmark_parse(const std::string& path)
+{
+  masiina::runtime::environment env;
+  const auto start = clock_type::now();
+  const auto result = masiina::runtime::parser::parse_file(env.runtime(), path);
+
+  if (!result)
+  {
+    return std::nullopt;
+  }
+
+  // Modules are decoded lazily, so decode them as well to include the cost
+  // of decoding values.
+  for (const auto& module : *result.value())
+  {
+    if (module->decode(env.runtime()))
+    {
+      return std::nullopt;
+    }
+  }
+
+  return measurement{
+    clock_type::now() - start,
+    static_cast<std::size_t>(result.value()->size())
+  };
+}
+
+static std::optional<measurement>
+benchmark_import(const std::string& path, const std::u32string& name)
+{
+  masiina::runtime::environment env;
+  const auto result = masiina::runtime::parser::parse_file(env.runtime(), path);
+
+  if (!result)
+  {
+    return std::nullopt;
+  }
+  for (const auto& module : *result.value())
+  {
+    env.add_imported_module(module);
+  }
+
+  const auto context = plorth::context::make(env.runtime());
+  const auto start = clock_type::now();
+
+  if (!env.import_module(context, name))
+  {
+    return std::nullopt;
+  }
+
+  return measurement{ clock_type::now() - start, 0 };
+}
+
+static std::optional<measurement>
+benchmark_run(const std::string& path)
+{
+  masiina::runtime::environment env;
+  const auto result = masiina::runtime::parser::parse_file(env.runtime(), path);
+  bool error_occurred = false;
+
+  if (!result || result.value()->empty())
+  {
+    return std::nullopt;
+  }
+
+  const auto& modules = *result.value();
+
+  for (const auto& module : modules)
+  {
+    env.add_imported_module(module);
+  }
+  if (env.decode_module(modules[0]))
+  {
+    return std::nullopt;
+  }
+
+  const auto start = clock_type::now();
+
+  env.spawn(modules[0]);
+  while (!env.is_finished())
+  {
+    if (env.step())
+    {
+      error_occurred = true;
+    }
+  }
+
+  const auto elapsed = clock_type::now() - start;
+
+  if (error_occurred)
+  {
+    return std::nullopt;
+  }
+
+  return measurement{ elapsed, env.statistics().steps };
+}
+
+/**
+ * Adds timers with pseudo-random deadlines up to 18 hours away into an timer
+ * wheel and then jumps from one deadline to the next, the way an idle
+ * environment does.
+ * Deadlines reported by the wheel and timers which it expires are checked
+ * against an ordered map of the pending deadlines, so the benchmark fails if
+ * an timer would be woken up too early or too late.
+ */
+static std::optional<measurement>
+benchmark_timers()
+{
+  using masiina::runtime::timer_wheel;
+  static const std::size_t timer_count = 10000;
+  const auto start = timer_wheel::clock::now();
+  timer_wheel wheel;
+  std::map<std::uint64_t, std::size_t> pending;
+  std::uint64_t now = 0;
+  std::uint64_t seed = 1;
+  std::size_t added = 0;
+  std::size_t expired = 0;
+
+  const auto add = [&]()
+  {
+    std::uint64_t delay;
+
+    // Mix short delays with ones beyond range of the topmost level of the
+    // wheel, which is a little over 4.6 hours.
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    delay = 1 + (seed >> 33) % (std::uint64_t(1) << (seed & 1 ? 16 : 26));
+    wheel.add(
+      start + std::chrono::milliseconds(now + delay),
+      std::shared_ptr<masiina::runtime::routine>()
+    );
+    ++pending[now + delay];
+    ++added;
+  };
+
+  const auto begin = clock_type::now();
+
+  while (added < timer_count / 2)
+  {
+    add();
+  }
+  while (!pending.empty())
+  {
+    const auto deadline = wheel.next_deadline();
+
+    // Reported deadline is rounded into whole milliseconds since creation
+    // of the wheel, which happened less than an millisecond after start.
+    if (!deadline
+        || static_cast<std::uint64_t>(
+             std::chrono::duration_cast<std::chrono::milliseconds>(
+               *deadline - start
+             ).count()
+           ) != std::begin(pending)->first)
+    {
+      std::cerr << "Timer wheel reported wrong deadline." << std::endl;
+
+      return std::nullopt;
+    }
+    now = std::begin(pending)->first;
+    if (wheel.advance(start + std::chrono::milliseconds(now)).size()
+        != std::begin(pending)->second)
+    {
+      std::cerr << "Timer wheel expired wrong timers." << std::endl;
+
+      return std::nullopt;
+    }
+    expired += std::begin(pending)->second;
+    pending.erase(std::begin(pending));
+    if (added < timer_count)
+    {
+      add();
+    }
+  }
+
+  return measurement{ clock_type::now() - begin, expired };
+}
+
+static std::optional<result>
+run_benchmark(const std::string& name, const benchmark_function& function)
+{
+  std::vector<std::chrono::nanoseconds> samples;
+  std::chrono::nanoseconds total(0);
+  std::size_t items = 0;
+
+  // First iteration warms up caches and is not included in the results.
+  if (!function())
+  {
+    return std::nullopt;
+  }
+  for (std::size_t i = 0; i < iteration_count; ++i)
+  {
+    const auto measurement = function();
+
+    if (!measurement)
+    {
+      return std::nullopt;
+    }
+    samples.push_back(measurement->elapsed);
+    total += measurement->elapsed;
+    items = measurement->items;
+  }
+  std::sort(std::begin(samples), std::end(samples));
+
+  return result{
+    name,
+    iteration_count,
+    samples.front(),
+    samples[samples.size() / 2],
+    total / static_cast<long>(samples.size()),
+    items
+  };
+}
+
+static void
+write_results(std::ostream& output, const std::vector<result>& results)
+{
+  output
+    << "{\n"
+    << "  \"version\": \""
+    << MASIINA_VERSION_MAJOR
+    << "."
+    << MASIINA_VERSION_MINOR
+    << "."
+    << MASIINA_VERSION_PATCH
+    << "\",\n"
+    << "  \"iterations\": "
+    << iteration_count
+    << ",\n"
+    << "  \"benchmarks\": [";
+  for (std::size_t i = 0; i < results.size(); ++i)
+  {
+    const auto& result = results[i];
+
+    output
+      << (i > 0 ? "," : "")
+      << "\n    {"
+      << "\"name\": \"" << result.name << "\", "
+      << "\"min_ns\": " << result.min.count() << ", "
+      << "\"median_ns\": " << result.median.count() << ", "
+      << "\"mean_ns\": " << result.mean.count();
+    if (result.items > 0)
+    {
+      const auto seconds = std::chrono::duration<double>(result.median).count();
+
+      output
+        << ", \"items\": " << result.items
+        << ", \"items_per_second\": "
+        << static_cast<std::uint64_t>(seconds > 0 ? result.items / seconds : 0);
+    }
+    output << "}";
+  }
+  output << "\n  ]\n}" << std::endl;
+}
+
+int
+main(int argc, char** argv)
+{
+  std::vector<std::pair<std::string, benchmark_function>> benchmarks;
+  std::vector<std::string> temporary_files;
+  std::vector<result> results;
+  bool failed = false;
+
+  scan_arguments(argc, argv);
+
+  const auto library_path = corpus_dir + "/" + library;
+
+  for (const auto program : programs)
+  {
+    const std::string source_path = corpus_dir + "/" + program;
+    const auto compiled_path = compile_to_file({ source_path });
+    const auto compressed_path = compile_to_file({ source_path }, true);
+    auto compiled_unit = std::make_shared<masiina::compiler::unit>();
+
+    if (!compiled_path
+        || !compressed_path
+        || compiled_unit->compile_file(source_path))
+    {
+      return EXIT_FAILURE;
+    }
+    temporary_files.push_back(*compiled_path);
+    temporary_files.push_back(*compressed_path);
+
+    benchmarks.emplace_back(
+      std::string("compile/") + program,
+      [source_path]() { return benchmark_compile(source_path); }
+    );
+    benchmarks.emplace_back(
+      std::string("write/") + program,
+      [compiled_unit]() { return benchmark_write(*compiled_unit); }
+    );
+    benchmarks.emplace_back(
+      std::string("parse/") + program,
+      [path = *compiled_path]() { return benchmark_parse(path); }
+    );
+    benchmarks.emplace_back(
+      std::string("parse-compressed/") + program,
+      [path = *compressed_path]() { return benchmark_parse(path); }
+    );
+    benchmarks.emplace_back(
+      std::string("run/") + program,
+      [path = *compiled_path]() { return benchmark_run(path); }
+    );
+  }
+
+  if (const auto compiled_path = compile_to_file({ library_path }))
+  {
+    const auto name = peelo::unicode::encoding::utf8::decode(library_path);
+
+    temporary_files.push_back(*compiled_path);
+    benchmarks.emplace_back(
+      std::string("import/") + library,
+      [path = *compiled_path, name]() { return benchmark_import(path, name); }
+    );
+  } else {
+    return EXIT_FAILURE;
+  }
+
+  benchmarks.emplace_back("timers", benchmark_timers);
+
+  for (const auto& benchmark : benchmarks)
+  {
+    if (!filter.empty() && benchmark.first.find(filter) == std::string::npos)
+    {
+      continue;
+    }
+    std::cerr << benchmark.first << "..." << std::endl;
+    if (const auto result = run_benchmark(benchmark.first, benchmark.second))
+    {
+      results.push_back(*result);
+    } else {
+      std::cerr << "Benchmark " << benchmark.first << " failed." << std::endl;
+      failed = true;
+    }
+  }
+
+  for (const auto& path : temporary_files)
+  {
+    std::remove(path.c_str());
+  }
+
+  write_results(std::cout, results);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace masiina::compiler::cache
+{
+  /**
+   * Identity of an module in the compilation cache. The hash names the file
+   * of the entry, while the digest and the length are stored inside the
+   * entry and compared when it's loaded, so that two modules whose hashes
+   * collide are not mistaken for each other.
+   */
+  struct key
+  {
+    /** FNV-1a hash of the module. */
+    std::uint64_t hash;
+    /** Second hash of the module, calculated independently of the first. */
+    std::uint64_t digest;
+    /** Number of bytes which were hashed. */
+    std::uint64_t length;
+  };
+
+  /**
+   * Compiled form of an module stored in the compilation cache.
+   */
+  struct entry
+  {
+    /** Words declared by the module. */
+    std::vector<std::u32string> declared_words;
+    /**
+     * Builtin words and number literals referenced by the module, and
+     * whether they had been declared as words in the compilation unit when
+     * the module was compiled.
+     */
+    std::vector<std::pair<std::u32string, bool>> dependencies;
+    /** Symbol table of the module, referenced by the bytecode. */
+    std::vector<std::u32string> symbols;
+    /** Bytecode of the module. */
+    std::vector<unsigned char> bytecode;
+    /** Source code positions of the module. */
+    std::vector<unsigned char> debug_info;
+
+    /**
+     * Determines whether the module would be compiled into the same
+     * bytecode with given set of words declared in the compilation unit.
+     */
+    bool is_valid(const std::unordered_set<std::u32string>& declared_words) const;
+  };
+
+  /**
+   * Calculates cache key for an module from given path and contents of the
+   * source code file, and version of the compiler.
+   */
+  key make_key(const std::string& path, const std::string& source);
+
+  /**
+   * Loads an entry from cache directory. Returns null pointer if the entry
+   * does not exist, it cannot be read or it belongs to another module.
+   */
+  std::shared_ptr<entry> load(const std::string& directory, const key& key);
+
+  /**
+   * Stores an entry into cache directory, which is created if it does not
+   * exist. The entry is first written into a temporary file which is then
+   * renamed, so that concurrent compilers never see partially written
+   * entries. Returns an error message if the entry cannot be stored.
+   */
+  std::optional<std::string> store(
+    const std::string& directory,
+    const key& key,
+    const entry& entry
+  );
+}
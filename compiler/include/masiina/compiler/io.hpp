@@ -34,9 +34,25 @@
 namespace masiina::compiler::io
 {
   std::optional<std::string> read_file_contents(const std::string& path);
+  bool read_uint32(
+    const std::string& input,
+    std::size_t& offset,
+    std::uint32_t& number
+  );
+  bool read_varint(
+    const std::string& input,
+    std::size_t& offset,
+    std::uint32_t& number
+  );
+  bool read_string(
+    const std::string& input,
+    std::size_t& offset,
+    std::u32string& str
+  );
   void write_uint16(std::vector<unsigned char>& output, std::uint16_t number);
-  void write_uint32(FILE* output, std::uint32_t number);
   void write_uint32(std::vector<unsigned char>& output, std::uint32_t number);
-  void write_string(FILE* output, const std::u32string& str);
+  void write_uint64(std::vector<unsigned char>& output, std::uint64_t number);
+  void write_varint(std::vector<unsigned char>& output, std::uint32_t number);
+  void write_svarint(std::vector<unsigned char>& output, std::int32_t number);
   void write_string(std::vector<unsigned char>& output, const std::u32string& str);
 }
@@ -25,11 +25,23 @@
  */
 #pragma once
 
+#include <map>
+#include <optional>
+#include <unordered_set>
+
+#include <masiina/compiler/cache.hpp>
 #include <masiina/compiler/symbol-map.hpp>
 #include <plorth/parser/ast.hpp>
 
 namespace masiina::compiler
 {
+  /**
+   * Builtin words and number literals referenced by an module, and whether
+   * they had been declared as words in the compilation unit, which
+   * determines how they were compiled.
+   */
+  using dependency_map = std::map<std::u32string, bool>;
+
   class module
   {
   public:
@@ -43,10 +55,116 @@ namespace masiina::compiler
     module(const module& that);
     module& operator=(const module& that);
 
-    std::vector<unsigned char> compile(class symbol_map& symbol_map) const;
+    inline const std::u32string& name() const
+    {
+      return m_name;
+    }
+
+    /**
+     * Parses given UTF-8 encoded source code into tokens of the module.
+     * Returns an error message if the source code cannot be parsed.
+     */
+    std::optional<std::string> parse(const std::string& source);
+
+    /**
+     * Returns key of the module in the compilation cache, if the cache is
+     * being used.
+     */
+    inline const std::optional<cache::key>& cache_key() const
+    {
+      return m_cache_key;
+    }
+
+    inline void cache_key(const cache::key& key)
+    {
+      m_cache_key = key;
+    }
+
+    /**
+     * Returns compiled form of the module loaded from the compilation cache,
+     * or null pointer if the module has been parsed from source code.
+     */
+    inline const std::shared_ptr<const cache::entry>& cache_entry() const
+    {
+      return m_cache_entry;
+    }
+
+    /**
+     * Uses given compiled form of the module loaded from the compilation
+     * cache instead of parsing the source code. The source code is retained
+     * in case the compiled form turns out to be out of date.
+     */
+    void cached(
+      const cache::key& key,
+      const std::shared_ptr<const cache::entry>& entry,
+      const std::string& source
+    );
+
+    /**
+     * Parses source code retained when the module was loaded from the
+     * compilation cache, and discards the compiled form.
+     */
+    std::optional<std::string> parse_cached_source();
+
+    /**
+     * Returns bytecode of an module linked from an existing compilation
+     * unit, or null pointer if the module is compiled from source code.
+     */
+    inline const std::shared_ptr<const std::vector<unsigned char>>&
+    linked_bytecode() const
+    {
+      return m_linked_bytecode;
+    }
+
+    /**
+     * Returns source code positions of an module linked from an existing
+     * compilation unit, or null pointer if the unit did not contain them.
+     */
+    inline const std::shared_ptr<const std::vector<unsigned char>>&
+    linked_debug_info() const
+    {
+      return m_linked_debug_info;
+    }
+
+    /**
+     * Uses given bytecode and debug info, whose symbol table indexes already
+     * refer to the symbol table of the compilation unit being written, as
+     * the compiled form of the module.
+     */
+    void linked(
+      const std::shared_ptr<const std::vector<unsigned char>>& bytecode,
+      const std::shared_ptr<const std::vector<unsigned char>>& debug_info
+    );
+
+    /**
+     * Inserts names of all words declared in the module into given set.
+     */
+    void collect_declared_words(
+      std::unordered_set<std::u32string>& declared_words
+    ) const;
+
+    /**
+     * Compiles the module into bytecode. References to builtin words are
+     * resolved into builtin indexes, unless the word is declared somewhere
+     * in the compilation unit, as given in the set of declared words. If
+     * given, builtin words and number literals referenced by the module are
+     * inserted into the dependency map, and source code positions of the
+     * instructions are written into the debug info.
+     */
+    std::vector<unsigned char> compile(
+      class symbol_map& symbol_map,
+      const std::unordered_set<std::u32string>& declared_words,
+      dependency_map* dependencies = nullptr,
+      std::vector<unsigned char>* debug_info = nullptr
+    ) const;
 
   private:
     std::u32string m_name;
     container_type m_tokens;
+    std::optional<std::string> m_source;
+    std::optional<cache::key> m_cache_key;
+    std::shared_ptr<const cache::entry> m_cache_entry;
+    std::shared_ptr<const std::vector<unsigned char>> m_linked_bytecode;
+    std::shared_ptr<const std::vector<unsigned char>> m_linked_debug_info;
   };
 }
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace masiina::compiler
+{
+  /**
+   * Calls given function with each index from zero to count - 1, using up
+   * to given number of threads, one of which is the calling thread. Zero
+   * uses one thread for each processor core. Indexes are handed out in
+   * order, but the calls may complete in any order.
+   */
+  inline void
+  parallel_for(
+    std::size_t count,
+    std::size_t jobs,
+    const std::function<void(std::size_t)>& function
+  )
+  {
+    std::atomic<std::size_t> next(0);
+    std::vector<std::thread> threads;
+    const auto worker = [&]()
+    {
+      std::size_t index;
+
+      while ((index = next.fetch_add(1, std::memory_order_relaxed)) < count)
+      {
+        function(index);
+      }
+    };
+
+    if (!jobs)
+    {
+      jobs = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    jobs = std::min(jobs, count);
+    for (std::size_t i = 1; i < jobs; ++i)
+    {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads)
+    {
+      thread.join();
+    }
+  }
+}
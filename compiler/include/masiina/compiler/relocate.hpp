@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace masiina::compiler
+{
+  /**
+   * Rewrites symbol table indexes in bytecode of an module, which refer to
+   * one symbol table, to refer to another one instead. Index N of the
+   * original symbol table is replaced with element N of given mapping.
+   * Returns false if the bytecode is malformed or refers to symbols which
+   * are not in the mapping.
+   */
+  bool relocate(
+    const std::vector<unsigned char>& input,
+    const std::vector<std::uint32_t>& mapping,
+    std::vector<unsigned char>& output
+  );
+
+  /**
+   * Rewrites filename indexes in debug info of an module, in the same way
+   * as relocate() rewrites symbol table indexes in it's bytecode.
+   */
+  bool relocate_debug_info(
+    const std::vector<unsigned char>& input,
+    const std::vector<std::uint32_t>& mapping,
+    std::vector<unsigned char>& output
+  );
+}
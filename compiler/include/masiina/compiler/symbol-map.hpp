@@ -26,7 +26,6 @@
 #pragma once
 
 #include <cstdint>
-#include <cstdio>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -40,9 +39,17 @@ namespace masiina::compiler
     symbol_map(const symbol_map& that);
     symbol_map& operator=(const symbol_map& that);
 
+    /**
+     * Returns the symbols in the order of their indexes.
+     */
+    inline const std::vector<std::u32string>& symbols() const
+    {
+      return m_list;
+    }
+
     std::uint32_t add(const std::u32string& str);
 
-    void write(FILE* output) const;
+    void write(std::vector<unsigned char>& output) const;
 
   private:
     std::vector<std::u32string> m_list;
@@ -39,12 +39,66 @@ namespace masiina::compiler
     unit(const unit& that);
     unit& operator=(const unit& that);
 
+    /**
+     * Enables the compilation cache, which is stored into given directory.
+     * Modules whose source code has not changed since they were last
+     * compiled are loaded from the cache instead of being compiled again.
+     * Must be called before any files are compiled.
+     */
+    void cache_directory(const std::string& directory);
+
+    /**
+     * Determines whether source code positions are omitted from the
+     * compilation unit when it's written.
+     */
+    void strip(bool strip);
+
+    /**
+     * Determines whether the compilation unit is compressed when it's
+     * written.
+     */
+    void compress(bool compress);
+
     std::optional<std::string> compile_file(const std::string& path);
 
-    void write(FILE* output);
+    /**
+     * Compiles given files using up to given number of threads. Zero uses
+     * one thread for each processor core. Modules are added in the same
+     * order as the files are given, regardless of the order in which they
+     * are compiled. Returns error of the first file which cannot be
+     * compiled, if any.
+     */
+    std::optional<std::string> compile_files(
+      const std::vector<std::string>& paths,
+      std::size_t jobs = 0
+    );
+
+    /**
+     * Adds modules of an existing compilation unit into this one, without
+     * compiling them again. Symbol table of the existing unit is merged into
+     * the symbol table of this one, and symbol table indexes in bytecode of
+     * the modules are rewritten accordingly. Words declared by the linked
+     * modules are not taken into account when modules of this unit are
+     * compiled, or vice versa. Returns an error message if the unit cannot
+     * be read or it contains a module which is already in this unit.
+     */
+    std::optional<std::string> link_file(const std::string& path);
+
+    /**
+     * Writes the compilation unit into given file. Bytecode of the modules
+     * is generated using up to given number of threads, each module with a
+     * symbol table of it's own, after which the symbol tables are merged in
+     * the order of the modules. The result is identical regardless of the
+     * number of threads. Returns an error message if the unit cannot be
+     * written.
+     */
+    std::optional<std::string> write(FILE* output, std::size_t jobs = 1);
 
   private:
     symbol_map m_symbol_map;
     std::vector<module> m_modules;
+    std::optional<std::string> m_cache_directory;
+    bool m_strip;
+    bool m_compress;
   };
 }
@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+#include <masiina/compiler/cache.hpp>
+#include <masiina/compiler/io.hpp>
+#include <masiina/version.hpp>
+#include <peelo/unicode/encoding/utf8.hpp>
+
+namespace masiina::compiler::cache
+{
+  static const std::uint64_t fnv_offset_basis = 0xcbf29ce484222325ULL;
+  static const std::uint64_t fnv_prime = 0x100000001b3ULL;
+  static const std::uint64_t digest_seed = 0x9e3779b97f4a7c15ULL;
+  static const std::uint64_t digest_multiplier = 0xff51afd7ed558ccdULL;
+
+  /**
+   * Sequential reader of a cache entry, which keeps track of whether it has
+   * ran past the end of the data.
+   */
+  class reader
+  {
+  public:
+    explicit reader(const std::string& data)
+      : m_data(data)
+      , m_offset(0)
+      , m_failed(false) {}
+
+    inline bool failed() const
+    {
+      return m_failed;
+    }
+
+    inline bool at_end() const
+    {
+      return m_offset == m_data.length();
+    }
+
+    bool read_bytes(std::size_t size, std::string& result)
+    {
+      if (m_failed || m_data.length() - m_offset < size)
+      {
+        m_failed = true;
+
+        return false;
+      }
+      result = m_data.substr(m_offset, size);
+      m_offset += size;
+
+      return true;
+    }
+
+    std::uint32_t read_uint32()
+    {
+      std::uint32_t result = 0;
+
+      if (!m_failed && !io::read_uint32(m_data, m_offset, result))
+      {
+        m_failed = true;
+      }
+
+      return result;
+    }
+
+    std::uint64_t read_uint64()
+    {
+      const std::uint64_t low = read_uint32();
+
+      return low | (static_cast<std::uint64_t>(read_uint32()) << 32);
+    }
+
+    std::u32string read_string()
+    {
+      std::u32string result;
+
+      if (!m_failed && !io::read_string(m_data, m_offset, result))
+      {
+        m_failed = true;
+      }
+
+      return result;
+    }
+
+    void read_strings(std::vector<std::u32string>& result)
+    {
+      const auto count = read_uint32();
+
+      for (std::uint32_t i = 0; i < count && !m_failed; ++i)
+      {
+        result.push_back(read_string());
+      }
+    }
+
+  private:
+    const std::string& m_data;
+    std::size_t m_offset;
+    bool m_failed;
+  };
+
+  static void
+  hash_bytes(key& key, const char* data, std::size_t size)
+  {
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      const auto byte = static_cast<unsigned char>(data[i]);
+
+      key.hash ^= byte;
+      key.hash *= fnv_prime;
+      // The digest uses different multiplier and folds high bits of the
+      // product back into the low ones, so that it doesn't collide on the
+      // same inputs as FNV-1a does.
+      key.digest ^= byte;
+      key.digest *= digest_multiplier;
+      key.digest ^= key.digest >> 29;
+    }
+    key.length += size;
+  }
+
+  static std::string
+  entry_path(const std::string& directory, const key& key)
+  {
+    char filename[32];
+
+    std::snprintf(
+      filename,
+      sizeof(filename),
+      "%016llx.cache",
+      static_cast<unsigned long long>(key.hash)
+    );
+
+    return (std::filesystem::path(directory) / filename).string();
+  }
+
+  static void
+  write_strings(
+    std::vector<unsigned char>& output,
+    const std::vector<std::u32string>& strings
+  )
+  {
+    io::write_uint32(output, static_cast<std::uint32_t>(strings.size()));
+    for (const auto& string : strings)
+    {
+      io::write_string(output, string);
+    }
+  }
+
+  bool
+  entry::is_valid(const std::unordered_set<std::u32string>& declared_words) const
+  {
+    for (const auto& dependency : dependencies)
+    {
+      const bool declared =
+        declared_words.find(dependency.first) != std::end(declared_words);
+
+      if (declared != dependency.second)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  key
+  make_key(const std::string& path, const std::string& source)
+  {
+    const char version[] =
+    {
+      MASIINA_VERSION_PATCH,
+      MASIINA_VERSION_MINOR,
+      MASIINA_VERSION_MAJOR,
+    };
+    key result = { fnv_offset_basis, digest_seed, 0 };
+
+    hash_bytes(result, version, sizeof(version));
+    // Path of the source code file ends up in the bytecode as part of the
+    // source code positions, so it has to be included in the key.
+    hash_bytes(result, path.c_str(), path.length() + 1);
+    hash_bytes(result, source.data(), source.length());
+
+    return result;
+  }
+
+  std::shared_ptr<entry>
+  load(const std::string& directory, const key& key)
+  {
+    const auto data = io::read_file_contents(entry_path(directory, key));
+    auto result = std::make_shared<entry>();
+    std::string header;
+    std::string bytecode;
+    std::string debug_info;
+    std::uint32_t count;
+
+    if (!data)
+    {
+      return nullptr;
+    }
+
+    reader reader(*data);
+
+    // Magic number and version of the compiler which wrote the entry.
+    if (!reader.read_bytes(6, header)
+        || header[0] != 'R'
+        || header[1] != 'j'
+        || header[2] != 'C'
+        || header[3] != MASIINA_VERSION_PATCH
+        || header[4] != MASIINA_VERSION_MINOR
+        || header[5] != MASIINA_VERSION_MAJOR)
+    {
+      return nullptr;
+    }
+
+    // Entries are named after the hash only, so the rest of the key tells
+    // whether the entry is for this module or one whose hash collides.
+    if (reader.read_uint64() != key.digest
+        || reader.read_uint64() != key.length
+        || reader.failed())
+    {
+      return nullptr;
+    }
+
+    reader.read_strings(result->declared_words);
+
+    count = reader.read_uint32();
+    for (std::uint32_t i = 0; i < count && !reader.failed(); ++i)
+    {
+      std::string declared;
+      const auto name = reader.read_string();
+
+      if (reader.read_bytes(1, declared))
+      {
+        result->dependencies.emplace_back(name, declared[0] != 0);
+      }
+    }
+
+    reader.read_strings(result->symbols);
+
+    if (!reader.read_bytes(reader.read_uint32(), bytecode)
+        || !reader.read_bytes(reader.read_uint32(), debug_info)
+        || !reader.at_end())
+    {
+      return nullptr;
+    }
+    result->bytecode.assign(std::begin(bytecode), std::end(bytecode));
+    result->debug_info.assign(std::begin(debug_info), std::end(debug_info));
+
+    return result;
+  }
+
+  std::optional<std::string>
+  store(
+    const std::string& directory,
+    const key& key,
+    const entry& entry
+  )
+  {
+    const auto path = entry_path(directory, key);
+    std::vector<unsigned char> output;
+    std::error_code error_code;
+    std::string temporary_path;
+    FILE* file;
+    bool written;
+
+    std::filesystem::create_directories(directory, error_code);
+    if (error_code)
+    {
+      return std::make_optional<std::string>(
+        "Unable to create cache directory `"
+        + directory
+        + "': "
+        + error_code.message()
+      );
+    }
+
+    output.push_back('R');
+    output.push_back('j');
+    output.push_back('C');
+    output.push_back(MASIINA_VERSION_PATCH);
+    output.push_back(MASIINA_VERSION_MINOR);
+    output.push_back(MASIINA_VERSION_MAJOR);
+    io::write_uint64(output, key.digest);
+    io::write_uint64(output, key.length);
+
+    write_strings(output, entry.declared_words);
+
+    io::write_uint32(output, static_cast<std::uint32_t>(entry.dependencies.size()));
+    for (const auto& dependency : entry.dependencies)
+    {
+      io::write_string(output, dependency.first);
+      output.push_back(dependency.second ? 1 : 0);
+    }
+
+    write_strings(output, entry.symbols);
+
+    io::write_uint32(output, static_cast<std::uint32_t>(entry.bytecode.size()));
+    output.insert(
+      std::end(output),
+      std::begin(entry.bytecode),
+      std::end(entry.bytecode)
+    );
+
+    io::write_uint32(output, static_cast<std::uint32_t>(entry.debug_info.size()));
+    output.insert(
+      std::end(output),
+      std::begin(entry.debug_info),
+      std::end(entry.debug_info)
+    );
+
+    temporary_path = path + "." + std::to_string(std::random_device()());
+    if (!(file = std::fopen(temporary_path.c_str(), "wb")))
+    {
+      return std::make_optional<std::string>(
+        "Unable to open file `"
+        + temporary_path
+        + "' for writing: "
+        + std::strerror(errno)
+      );
+    }
+    written = std::fwrite(
+      static_cast<const void*>(output.data()),
+      output.size(),
+      1,
+      file
+    ) == 1;
+    if (std::fclose(file) != 0 || !written)
+    {
+      std::remove(temporary_path.c_str());
+
+      return std::make_optional<std::string>(
+        "Unable to write file `"
+        + temporary_path
+        + "': "
+        + std::strerror(errno)
+      );
+    }
+
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0)
+    {
+      const auto message = std::strerror(errno);
+
+      std::remove(temporary_path.c_str());
+
+      return std::make_optional<std::string>(
+        "Unable to rename `"
+        + temporary_path
+        + "' to `"
+        + path
+        + "': "
+        + message
+      );
+    }
+
+    return std::nullopt;
+  }
+}
@@ -64,20 +64,85 @@ namespace masiina::compiler::io
     return result;
   }
 
-  void
-  write_uint16(std::vector<unsigned char>& output, std::uint16_t number)
+  bool
+  read_uint32(
+    const std::string& input,
+    std::size_t& offset,
+    std::uint32_t& number
+  )
   {
-    output.push_back(static_cast<unsigned char>((number >> 0) & 0xff));
-    output.push_back(static_cast<unsigned char>((number >> 8) & 0xff));
+    if (input.length() - offset < 4)
+    {
+      return false;
+    }
+    number = 0;
+    for (int i = 3; i >= 0; --i)
+    {
+      number = (number << 8) | static_cast<unsigned char>(input[offset + i]);
+    }
+    offset += 4;
+
+    return true;
+  }
+
+  bool
+  read_varint(
+    const std::string& input,
+    std::size_t& offset,
+    std::uint32_t& number
+  )
+  {
+    number = 0;
+    for (int shift = 0; shift < 32; shift += 7)
+    {
+      unsigned char byte;
+
+      if (offset >= input.length())
+      {
+        return false;
+      }
+      byte = static_cast<unsigned char>(input[offset++]);
+      number |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool
+  read_string(
+    const std::string& input,
+    std::size_t& offset,
+    std::u32string& str
+  )
+  {
+    std::uint32_t length;
+
+    if (!read_varint(input, offset, length) || input.length() - offset < length)
+    {
+      return false;
+    }
+    str.clear();
+    if (!peelo::unicode::encoding::utf8::decode_validate(
+      input.substr(offset, length),
+      str
+    ))
+    {
+      return false;
+    }
+    offset += length;
+
+    return true;
   }
 
   void
-  write_uint32(FILE* output, std::uint32_t number)
+  write_uint16(std::vector<unsigned char>& output, std::uint16_t number)
   {
-    std::fputc((number >> 0) & 0xff, output);
-    std::fputc((number >> 8) & 0xff, output);
-    std::fputc((number >> 16) & 0xff, output);
-    std::fputc((number >> 24) & 0xff, output);
+    output.push_back(static_cast<unsigned char>((number >> 0) & 0xff));
+    output.push_back(static_cast<unsigned char>((number >> 8) & 0xff));
   }
 
   void
@@ -90,15 +155,32 @@ namespace masiina::compiler::io
   }
 
   void
-  write_string(FILE* output, const std::u32string& str)
+  write_uint64(std::vector<unsigned char>& output, std::uint64_t number)
   {
-    const auto encoded_str = peelo::unicode::encoding::utf8::encode(str);
+    write_uint32(output, static_cast<std::uint32_t>(number & 0xffffffff));
+    write_uint32(output, static_cast<std::uint32_t>(number >> 32));
+  }
 
-    write_uint32(output, static_cast<std::uint32_t>(encoded_str.length()));
-    for (const auto& c : encoded_str)
+  void
+  write_varint(std::vector<unsigned char>& output, std::uint32_t number)
+  {
+    while (number >= 0x80)
     {
-      std::fputc(static_cast<unsigned char>(c), output);
+      output.push_back(static_cast<unsigned char>((number & 0x7f) | 0x80));
+      number >>= 7;
     }
+    output.push_back(static_cast<unsigned char>(number));
+  }
+
+  void
+  write_svarint(std::vector<unsigned char>& output, std::int32_t number)
+  {
+    // Zigzag encoding maps small negative numbers to small positive ones.
+    write_varint(
+      output,
+      (static_cast<std::uint32_t>(number) << 1)
+        ^ static_cast<std::uint32_t>(number >> 31)
+    );
   }
 
   void
@@ -106,7 +188,7 @@ namespace masiina::compiler::io
   {
     const auto encoded_str = peelo::unicode::encoding::utf8::encode(str);
 
-    write_uint32(output, static_cast<std::uint32_t>(encoded_str.length()));
+    write_varint(output, static_cast<std::uint32_t>(encoded_str.length()));
     for (const auto& c : encoded_str)
     {
       output.push_back(static_cast<unsigned char>(c));
@@ -42,6 +42,11 @@
 
 static std::vector<std::string> input_paths;
 static std::string output_path;
+static std::size_t job_count = 0;
+static std::string cache_directory;
+static bool link_units = false;
+static bool strip = false;
+static bool compress = false;
 
 static void
 print_usage(const char* executable)
@@ -53,6 +58,19 @@ print_usage(const char* executable)
     << " [switches] <filename...>"
     << std::endl
     << "  -o <path> Where to write the compiled bytecode to." << std::endl
+    << "  -j <n>    Compile in <n> threads. Zero uses one thread for each"
+    << std::endl
+    << "            processor core, which is the default." << std::endl
+    << "  --strip   Omit source code positions from the bytecode." << std::endl
+    << "  --compress" << std::endl
+    << "            Compress the bytecode." << std::endl
+    << "  --link    Link given compilation units into one instead of compiling"
+    << std::endl
+    << "            source code files." << std::endl
+    << "  --cache-dir=<dir>" << std::endl
+    << "            Cache compiled modules in <dir> and reuse them when their"
+    << std::endl
+    << "            source code has not changed." << std::endl
     << "  --version Print the version." << std::endl
     << "  --help    Display this message." << std::endl;
 }
@@ -97,6 +115,28 @@ scan_arguments(int argc, char** argv)
             << MASIINA_VERSION_PATCH
             << std::endl;
           std::exit(EXIT_SUCCESS);
+        }
+        else if (!std::strcmp(arg, "--strip"))
+        {
+          strip = true;
+        }
+        else if (!std::strcmp(arg, "--compress"))
+        {
+          compress = true;
+        }
+        else if (!std::strcmp(arg, "--link"))
+        {
+          link_units = true;
+        }
+        else if (!std::strncmp(arg, "--cache-dir=", 12))
+        {
+          cache_directory = arg + 12;
+          if (cache_directory.empty())
+          {
+            std::cerr << "Argument expected for the --cache-dir option." << std::endl;
+            print_usage(argv[0]);
+            std::exit(EX_USAGE);
+          }
         } else {
           std::cerr << "Unrecognized switch: " << arg << std::endl;
           print_usage(argv[0]);
@@ -118,6 +158,31 @@ scan_arguments(int argc, char** argv)
               }
               break;
 
+            case 'j':
+            {
+              const char* value;
+              char* end;
+
+              if (offset >= argc)
+              {
+                std::cerr << "Argument expected for the -j option." << std::endl;
+                print_usage(argv[0]);
+                std::exit(EX_USAGE);
+              }
+              value = argv[offset++];
+              job_count = static_cast<std::size_t>(std::strtoul(value, &end, 10));
+              if (!*value || *end)
+              {
+                std::cerr
+                  << "Invalid argument for the -j option: "
+                  << value
+                  << std::endl;
+                print_usage(argv[0]);
+                std::exit(EX_USAGE);
+              }
+              break;
+            }
+
             case 'h':
               print_usage(argv[0]);
               std::exit(EXIT_SUCCESS);
@@ -145,16 +210,30 @@ main(int argc, char** argv)
     std::exit(EX_USAGE);
   }
 
-  for (const auto& path : input_paths)
+  unit.strip(strip);
+  unit.compress(compress);
+
+  if (!cache_directory.empty())
   {
-    const auto error = unit.compile_file(path);
+    unit.cache_directory(cache_directory);
+  }
 
-    if (error)
+  if (link_units)
+  {
+    for (const auto& path : input_paths)
     {
-      std::cerr << *error << std::endl;
-      std::exit(EXIT_FAILURE);
+      if (const auto error = unit.link_file(path))
+      {
+        std::cerr << *error << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
     }
   }
+  else if (const auto error = unit.compile_files(input_paths, job_count))
+  {
+    std::cerr << *error << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
 
   if (!(output = std::fopen(output_path.c_str(), "wb")))
   {
@@ -167,7 +246,12 @@ main(int argc, char** argv)
     std::exit(EXIT_FAILURE);
   }
 
-  unit.write(output);
+  if (const auto error = unit.write(output, job_count))
+  {
+    std::cerr << *error << std::endl;
+    std::fclose(output);
+    std::exit(EXIT_FAILURE);
+  }
   std::fclose(output);
 
   return EXIT_SUCCESS;
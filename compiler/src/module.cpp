@@ -23,22 +23,215 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include <masiina/builtins.hpp>
 #include <masiina/compiler/io.hpp>
 #include <masiina/compiler/module.hpp>
 #include <masiina/compiler/symbol-map.hpp>
 #include <masiina/opcode.hpp>
+#include <peelo/unicode/encoding/utf8.hpp>
+#include <plorth/parser.hpp>
 #include <plorth/parser/visitor.hpp>
 
 namespace masiina::compiler
 {
   static const std::size_t long_symbol_length = 25;
 
+  enum class number_type
+  {
+    none,
+    integer,
+    real,
+  };
+
+  static inline bool
+  is_digit(char32_t c)
+  {
+    return c >= '0' && c <= '9';
+  }
+
+  /**
+   * Determines whether given symbol identifier is an number literal, using
+   * the same syntax as Plorth does. Returns the type of number the literal
+   * would be converted into, or none if it isn't an number or cannot be
+   * represented without loss.
+   */
+  static number_type
+  parse_number(
+    const std::u32string& id,
+    std::int64_t& integer_value,
+    double& real_value
+  )
+  {
+    const auto length = id.length();
+    std::string buffer;
+    std::size_t start = 0;
+    bool dot_seen = false;
+    bool exponent_seen = false;
+    char* end;
+
+    if (id[0] == '+' || id[0] == '-')
+    {
+      start = 1;
+    }
+
+    if (start >= length || !is_digit(id[start]))
+    {
+      return number_type::none;
+    }
+
+    for (auto i = start; i < length; ++i)
+    {
+      auto c = id[i];
+
+      if (c == '.')
+      {
+        if (dot_seen || exponent_seen || i + 1 >= length || !is_digit(id[i + 1]))
+        {
+          return number_type::none;
+        }
+        dot_seen = true;
+      }
+      else if (c == 'e' || c == 'E')
+      {
+        if (exponent_seen || i + 1 >= length)
+        {
+          return number_type::none;
+        }
+        exponent_seen = true;
+        if (id[i + 1] == '+' || id[i + 1] == '-')
+        {
+          buffer.push_back(static_cast<char>(c));
+          c = id[++i];
+        }
+        if (i + 1 >= length || !is_digit(id[i + 1]))
+        {
+          return number_type::none;
+        }
+      }
+      else if (!is_digit(c))
+      {
+        return number_type::none;
+      }
+      buffer.push_back(static_cast<char>(c));
+    }
+
+    if (id[0] == '-')
+    {
+      buffer.insert(std::begin(buffer), '-');
+    }
+
+    errno = 0;
+    if (!dot_seen && !exponent_seen)
+    {
+      const auto value = std::strtoll(buffer.c_str(), &end, 10);
+
+      if (errno == ERANGE || *end)
+      {
+        return number_type::none;
+      }
+      integer_value = static_cast<std::int64_t>(value);
+
+      return number_type::integer;
+    }
+
+    real_value = std::strtod(buffer.c_str(), &end);
+    if (errno == ERANGE || *end)
+    {
+      return number_type::none;
+    }
+
+    return number_type::real;
+  }
+
+  static std::optional<std::uint16_t>
+  find_builtin(const std::u32string& id)
+  {
+    for (std::size_t i = 0; i < builtins::count; ++i)
+    {
+      if (!id.compare(builtins::words[i]))
+      {
+        return static_cast<std::uint16_t>(i);
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  class declaration_visitor : public plorth::parser::ast::visitor<
+    std::unordered_set<std::u32string>&
+  >
+  {
+  public:
+    void
+    visit_array(
+      const std::shared_ptr<plorth::parser::ast::array>& token,
+      std::unordered_set<std::u32string>& declared_words
+    ) const override
+    {
+      for (const auto& element : token->elements())
+      {
+        visit(element, declared_words);
+      }
+    }
+
+    void
+    visit_quote(
+      const std::shared_ptr<plorth::parser::ast::quote>& token,
+      std::unordered_set<std::u32string>& declared_words
+    ) const override
+    {
+      for (const auto& child : token->children())
+      {
+        visit(child, declared_words);
+      }
+    }
+
+    void
+    visit_object(
+      const std::shared_ptr<plorth::parser::ast::object>& token,
+      std::unordered_set<std::u32string>& declared_words
+    ) const override
+    {
+      for (const auto& property : token->properties())
+      {
+        visit(property.second, declared_words);
+      }
+    }
+
+    void
+    visit_word(
+      const std::shared_ptr<plorth::parser::ast::word>& token,
+      std::unordered_set<std::u32string>& declared_words
+    ) const override
+    {
+      declared_words.insert(token->symbol()->id());
+      visit_quote(token->quote(), declared_words);
+    }
+  };
+
   class compile_visitor : public plorth::parser::ast::visitor<
     symbol_map&,
     std::vector<unsigned char>&
   >
   {
   public:
+    explicit compile_visitor(
+      const std::unordered_set<std::u32string>& declared_words,
+      dependency_map* dependencies,
+      std::vector<unsigned char>* debug_info
+    )
+      : m_declared_words(declared_words)
+      , m_dependencies(dependencies)
+      , m_debug_info(debug_info)
+      , m_instruction_count(0)
+      , m_next_instruction(0)
+      , m_line(0) {}
+
     void
     visit_array(
       const std::shared_ptr<plorth::parser::ast::array>& token,
@@ -48,8 +241,8 @@ namespace masiina::compiler
     {
       const auto& elements = token->elements();
 
-      output.push_back(static_cast<unsigned char>(opcode::push_array));
-      io::write_uint32(output, static_cast<std::uint32_t>(elements.size()));
+      write_opcode(opcode::push_array, output);
+      io::write_varint(output, static_cast<std::uint32_t>(elements.size()));
       for (const auto& element : elements)
       {
         visit(element, symbol_map, output);
@@ -65,8 +258,8 @@ namespace masiina::compiler
     {
       const auto& children = token->children();
 
-      output.push_back(static_cast<unsigned char>(opcode::push_quote));
-      io::write_uint32(output, static_cast<std::uint32_t>(children.size()));
+      write_opcode(opcode::push_quote, output);
+      io::write_varint(output, static_cast<std::uint32_t>(children.size()));
       for (const auto& element : children)
       {
         visit(element, symbol_map, output);
@@ -82,8 +275,8 @@ namespace masiina::compiler
     {
       const auto& properties = token->properties();
 
-      output.push_back(opcode::push_object);
-      io::write_uint32(output, static_cast<std::uint32_t>(properties.size()));
+      write_opcode(opcode::push_object, output);
+      io::write_varint(output, static_cast<std::uint32_t>(properties.size()));
       for (const auto& property : properties)
       {
         if (property.first.length() > long_symbol_length)
@@ -92,7 +285,7 @@ namespace masiina::compiler
           io::write_string(output, property.first);
         } else {
           output.push_back(opcode::push_string_const);
-          io::write_uint32(output, symbol_map.add(property.first));
+          io::write_varint(output, symbol_map.add(property.first));
         }
         visit(property.second, symbol_map, output);
       }
@@ -109,11 +302,11 @@ namespace masiina::compiler
 
       if (value.length() > long_symbol_length)
       {
-        output.push_back(opcode::push_string);
+        write_opcode(opcode::push_string, output);
         io::write_string(output, value);
       } else {
-        output.push_back(opcode::push_string_const);
-        io::write_uint32(output, symbol_map.add(value));
+        write_opcode(opcode::push_string_const, output);
+        io::write_varint(output, symbol_map.add(value));
       }
     }
 
@@ -123,21 +316,160 @@ namespace masiina::compiler
       class symbol_map& symbol_map,
       std::vector<unsigned char>& output
     ) const override
+    {
+      const auto& id = token->id();
+      std::int64_t integer_value = 0;
+      double real_value = 0;
+
+      // Words declared by the program itself shadow both builtin words and
+      // number literals, so those have to be executed by name.
+      if (m_declared_words.find(id) != std::end(m_declared_words))
+      {
+        if (m_dependencies
+            && (find_builtin(id)
+                || parse_number(id, integer_value, real_value)
+                  != number_type::none))
+        {
+          m_dependencies->emplace(id, true);
+        }
+        write_symbol(token, symbol_map, output);
+        return;
+      }
+
+      if (const auto builtin = find_builtin(id))
+      {
+        add_dependency(id);
+        write_opcode(opcode::call_builtin, output);
+        io::write_uint16(output, *builtin);
+        write_position(token->position(), symbol_map);
+        return;
+      }
+
+      // Number literals are converted into numbers already during
+      // compilation, so that the runtime doesn't have to parse them every
+      // time they are being executed.
+      switch (parse_number(id, integer_value, real_value))
+      {
+        case number_type::integer:
+          add_dependency(id);
+          write_opcode(opcode::push_integer, output);
+          io::write_uint64(output, static_cast<std::uint64_t>(integer_value));
+          return;
+
+        case number_type::real:
+        {
+          std::uint64_t bits;
+
+          static_assert(sizeof(bits) == sizeof(real_value));
+          std::memcpy(
+            static_cast<void*>(&bits),
+            static_cast<const void*>(&real_value),
+            sizeof(bits)
+          );
+          add_dependency(id);
+          write_opcode(opcode::push_real, output);
+          io::write_uint64(output, bits);
+          return;
+        }
+
+        case number_type::none:
+          break;
+      }
+
+      write_symbol(token, symbol_map, output);
+    }
+
+    /**
+     * Records that given builtin word or number literal has been compiled
+     * as such, because no word with the same name has been declared.
+     */
+    void
+    add_dependency(const std::u32string& id) const
+    {
+      if (m_dependencies)
+      {
+        m_dependencies->emplace(id, false);
+      }
+    }
+
+    void
+    write_symbol(
+      const std::shared_ptr<plorth::parser::ast::symbol>& token,
+      class symbol_map& symbol_map,
+      std::vector<unsigned char>& output
+    ) const
     {
       const auto& position = token->position();
       const auto& id = token->id();
 
       if (id.length() > long_symbol_length)
       {
-        output.push_back(opcode::push_symbol);
+        write_opcode(opcode::push_symbol, output);
         io::write_string(output, id);
       } else {
-        output.push_back(opcode::push_symbol_const);
-        io::write_uint32(output, symbol_map.add(id));
+        write_opcode(opcode::push_symbol_const, output);
+        io::write_varint(output, symbol_map.add(id));
+      }
+      write_position(position, symbol_map);
+    }
+
+    /**
+     * Writes opcode of an instruction. Instructions are numbered in the
+     * order they are written, which is how the source code positions in the
+     * debug section refer to them.
+     */
+    void
+    write_opcode(unsigned char opcode, std::vector<unsigned char>& output) const
+    {
+      output.push_back(opcode);
+      ++m_instruction_count;
+    }
+
+    /**
+     * Writes source code position of the instruction which was written last
+     * into the debug section. Each entry begins with the number of
+     * instructions between it and the previous instruction which has a
+     * position, shifted left by one bit. The lowest bit tells whether index
+     * of the filename follows, which it only does when the filename differs
+     * from the one of the previous entry. Line number is encoded as a
+     * difference to the previous entry, and it's followed by the column
+     * number.
+     */
+    void
+    write_position(
+      const plorth::parser::position& position,
+      class symbol_map& symbol_map
+    ) const
+    {
+      const auto instruction = m_instruction_count - 1;
+      std::uint32_t file;
+      bool file_changed;
+
+      if (!m_debug_info)
+      {
+        return;
+      }
+      file = symbol_map.add(position.file);
+      file_changed = !m_file || *m_file != file;
+      io::write_varint(
+        *m_debug_info,
+        ((instruction - m_next_instruction) << 1) | (file_changed ? 1 : 0)
+      );
+      if (file_changed)
+      {
+        io::write_varint(*m_debug_info, file);
       }
-      io::write_uint32(output, symbol_map.add(position.file));
-      io::write_uint16(output, static_cast<std::uint16_t>(position.line));
-      io::write_uint16(output, static_cast<std::uint16_t>(position.column));
+      io::write_svarint(
+        *m_debug_info,
+        static_cast<std::int32_t>(position.line - m_line)
+      );
+      io::write_varint(
+        *m_debug_info,
+        static_cast<std::uint32_t>(position.column)
+      );
+      m_next_instruction = instruction + 1;
+      m_file = file;
+      m_line = position.line;
     }
 
     void
@@ -147,10 +479,19 @@ namespace masiina::compiler
       std::vector<unsigned char>& output
     ) const override
     {
-      output.push_back(opcode::declare_word);
-      visit_symbol(token->symbol(), symbol_map, output);
+      write_opcode(opcode::declare_word, output);
+      write_symbol(token->symbol(), symbol_map, output);
       visit_quote(token->quote(), symbol_map, output);
     }
+
+  private:
+    const std::unordered_set<std::u32string>& m_declared_words;
+    dependency_map* const m_dependencies;
+    std::vector<unsigned char>* const m_debug_info;
+    mutable std::uint32_t m_instruction_count;
+    mutable std::uint32_t m_next_instruction;
+    mutable std::optional<std::uint32_t> m_file;
+    mutable int m_line;
   };
 
   module::module(
@@ -162,25 +503,146 @@ namespace masiina::compiler
 
   module::module(const module& that)
     : m_name(that.m_name)
-    , m_tokens(that.m_tokens) {}
+    , m_tokens(that.m_tokens)
+    , m_source(that.m_source)
+    , m_cache_key(that.m_cache_key)
+    , m_cache_entry(that.m_cache_entry)
+    , m_linked_bytecode(that.m_linked_bytecode)
+    , m_linked_debug_info(that.m_linked_debug_info) {}
 
   module&
   module::operator=(const module& that)
   {
     m_name = that.m_name;
     m_tokens = that.m_tokens;
+    m_source = that.m_source;
+    m_cache_key = that.m_cache_key;
+    m_cache_entry = that.m_cache_entry;
+    m_linked_bytecode = that.m_linked_bytecode;
+    m_linked_debug_info = that.m_linked_debug_info;
 
     return *this;
   }
 
+  std::optional<std::string>
+  module::parse(const std::string& source)
+  {
+    std::u32string decoded_source;
+    plorth::parser::position position = { m_name, 1, 0 };
+
+    if (!peelo::unicode::encoding::utf8::decode_validate(source, decoded_source))
+    {
+      return std::make_optional<std::string>(
+        "Unable to decode contents of `"
+        + peelo::unicode::encoding::utf8::encode(m_name)
+        + "' with UTF-8 character encoding."
+      );
+    }
+
+    auto begin = std::cbegin(decoded_source);
+    const auto end = std::cend(decoded_source) - 1;
+    const auto result = plorth::parser::parse(begin, end, position);
+
+    if (!result)
+    {
+      const auto& error = result.error();
+
+      if (!error)
+      {
+        return std::make_optional<std::string>("Unknown error.");
+      }
+
+      return std::make_optional<std::string>(
+        peelo::unicode::encoding::utf8::encode(error->position.file)
+        + ":"
+        + std::to_string(error->position.line)
+        + ":"
+        + std::to_string(error->position.column)
+        + ": "
+        + peelo::unicode::encoding::utf8::encode(error->message)
+      );
+    }
+    m_tokens = *result.value();
+    m_source.reset();
+    m_cache_entry.reset();
+
+    return std::nullopt;
+  }
+
+  void
+  module::cached(
+    const cache::key& key,
+    const std::shared_ptr<const cache::entry>& entry,
+    const std::string& source
+  )
+  {
+    m_tokens.clear();
+    m_source = source;
+    m_cache_key = key;
+    m_cache_entry = entry;
+  }
+
+  std::optional<std::string>
+  module::parse_cached_source()
+  {
+    if (!m_source)
+    {
+      return std::nullopt;
+    }
+
+    const auto source = *m_source;
+
+    return parse(source);
+  }
+
+  void
+  module::linked(
+    const std::shared_ptr<const std::vector<unsigned char>>& bytecode,
+    const std::shared_ptr<const std::vector<unsigned char>>& debug_info
+  )
+  {
+    m_tokens.clear();
+    m_source.reset();
+    m_cache_key.reset();
+    m_cache_entry.reset();
+    m_linked_bytecode = bytecode;
+    m_linked_debug_info = debug_info;
+  }
+
+  void
+  module::collect_declared_words(
+    std::unordered_set<std::u32string>& declared_words
+  ) const
+  {
+    declaration_visitor visitor;
+
+    if (m_cache_entry)
+    {
+      declared_words.insert(
+        std::begin(m_cache_entry->declared_words),
+        std::end(m_cache_entry->declared_words)
+      );
+      return;
+    }
+
+    for (const auto& token : m_tokens)
+    {
+      visitor.visit(token, declared_words);
+    }
+  }
+
   std::vector<unsigned char>
-  module::compile(class symbol_map& symbol_map) const
+  module::compile(
+    class symbol_map& symbol_map,
+    const std::unordered_set<std::u32string>& declared_words,
+    dependency_map* dependencies,
+    std::vector<unsigned char>* debug_info
+  ) const
   {
     std::vector<unsigned char> output;
-    compile_visitor visitor;
+    compile_visitor visitor(declared_words, dependencies, debug_info);
 
-    io::write_uint32(output, symbol_map.add(m_name));
-    io::write_uint32(output, static_cast<std::uint32_t>(m_tokens.size()));
+    io::write_varint(output, static_cast<std::uint32_t>(m_tokens.size()));
     for (const auto& token : m_tokens)
     {
       visitor.visit(token, symbol_map, output);
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <masiina/compiler/io.hpp>
+#include <masiina/compiler/relocate.hpp>
+#include <masiina/opcode.hpp>
+
+namespace masiina::compiler
+{
+  class relocator
+  {
+  public:
+    explicit relocator(
+      const std::vector<unsigned char>& input,
+      const std::vector<std::uint32_t>& mapping,
+      std::vector<unsigned char>& output
+    )
+      : m_current(input.data())
+      , m_end(input.data() + input.size())
+      , m_mapping(mapping)
+      , m_output(output) {}
+
+    bool
+    relocate_module()
+    {
+      return relocate_sequence() && m_current == m_end;
+    }
+
+    bool
+    relocate_debug_info()
+    {
+      while (m_current < m_end)
+      {
+        std::uint32_t distance;
+
+        // Distance from the previous instruction, followed by filename index
+        // if the lowest bit of the distance is set, line and column.
+        if (!read_varint(distance))
+        {
+          return false;
+        }
+        io::write_varint(m_output, distance);
+        if (((distance & 1) && !relocate_index())
+            || !copy_varint()
+            || !copy_varint())
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+  private:
+    bool
+    read_varint(std::uint32_t& number)
+    {
+      number = 0;
+      for (int shift = 0; shift < 32; shift += 7)
+      {
+        if (m_current >= m_end)
+        {
+          return false;
+        }
+        number |= static_cast<std::uint32_t>(*m_current & 0x7f) << shift;
+        if (!(*m_current++ & 0x80))
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    bool
+    copy(std::size_t size)
+    {
+      if (static_cast<std::size_t>(m_end - m_current) < size)
+      {
+        return false;
+      }
+      m_output.insert(std::end(m_output), m_current, m_current + size);
+      m_current += size;
+
+      return true;
+    }
+
+    bool
+    relocate_index()
+    {
+      std::uint32_t index;
+
+      if (!read_varint(index) || index >= m_mapping.size())
+      {
+        return false;
+      }
+      io::write_varint(m_output, m_mapping[index]);
+
+      return true;
+    }
+
+    bool
+    copy_string()
+    {
+      std::uint32_t length;
+
+      if (!read_varint(length))
+      {
+        return false;
+      }
+      io::write_varint(m_output, length);
+
+      return copy(length);
+    }
+
+    bool
+    copy_varint()
+    {
+      std::uint32_t number;
+
+      if (!read_varint(number))
+      {
+        return false;
+      }
+      io::write_varint(m_output, number);
+
+      return true;
+    }
+
+    /**
+     * Relocates instruction count followed by that many instructions.
+     */
+    bool
+    relocate_sequence()
+    {
+      std::uint32_t size;
+
+      if (!read_varint(size))
+      {
+        return false;
+      }
+      io::write_varint(m_output, size);
+      for (std::uint32_t i = 0; i < size; ++i)
+      {
+        if (!relocate_instruction())
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    bool
+    relocate_object()
+    {
+      std::uint32_t size;
+
+      if (!read_varint(size))
+      {
+        return false;
+      }
+      io::write_varint(m_output, size);
+      for (std::uint32_t i = 0; i < size; ++i)
+      {
+        if (m_current >= m_end)
+        {
+          return false;
+        }
+        m_output.push_back(*m_current);
+        switch (*m_current++)
+        {
+          case opcode::push_string:
+            if (!copy_string())
+            {
+              return false;
+            }
+            break;
+
+          case opcode::push_string_const:
+            if (!relocate_index())
+            {
+              return false;
+            }
+            break;
+
+          default:
+            return false;
+        }
+        if (!relocate_instruction())
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    bool
+    relocate_instruction()
+    {
+      unsigned char opcode;
+
+      if (m_current >= m_end)
+      {
+        return false;
+      }
+      opcode = *m_current++;
+      m_output.push_back(opcode);
+      switch (opcode)
+      {
+        case opcode::push_array:
+        case opcode::push_quote:
+          return relocate_sequence();
+
+        case opcode::push_integer:
+        case opcode::push_real:
+          return copy(8);
+
+        case opcode::push_object:
+          return relocate_object();
+
+        case opcode::push_string:
+          return copy_string();
+
+        case opcode::push_string_const:
+          return relocate_index();
+
+        case opcode::push_symbol:
+          return copy_string();
+
+        case opcode::push_symbol_const:
+          return relocate_index();
+
+        case opcode::call_builtin:
+          return copy(2);
+
+        case opcode::declare_word:
+          // Name of the word followed by it's quote.
+          return relocate_instruction() && relocate_instruction();
+      }
+
+      return false;
+    }
+
+  private:
+    const unsigned char* m_current;
+    const unsigned char* const m_end;
+    const std::vector<std::uint32_t>& m_mapping;
+    std::vector<unsigned char>& m_output;
+  };
+
+  bool
+  relocate(
+    const std::vector<unsigned char>& input,
+    const std::vector<std::uint32_t>& mapping,
+    std::vector<unsigned char>& output
+  )
+  {
+    relocator relocator(input, mapping, output);
+
+    output.reserve(output.size() + input.size());
+
+    return relocator.relocate_module();
+  }
+
+  bool
+  relocate_debug_info(
+    const std::vector<unsigned char>& input,
+    const std::vector<std::uint32_t>& mapping,
+    std::vector<unsigned char>& output
+  )
+  {
+    relocator relocator(input, mapping, output);
+
+    output.reserve(output.size() + input.size());
+
+    return relocator.relocate_debug_info();
+  }
+}
@@ -61,7 +61,7 @@ namespace masiina::compiler
   }
 
   void
-  symbol_map::write(FILE* output) const
+  symbol_map::write(std::vector<unsigned char>& output) const
   {
     io::write_uint32(output, static_cast<std::uint32_t>(m_list.size()));
     for (const auto& str : m_list)
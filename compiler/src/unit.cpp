@@ -23,39 +23,72 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
+#include <iostream>
 
+#include <masiina/compiler/cache.hpp>
 #include <masiina/compiler/io.hpp>
+#include <masiina/compiler/parallel.hpp>
+#include <masiina/compiler/relocate.hpp>
 #include <masiina/compiler/unit.hpp>
+#include <masiina/compression.hpp>
+#include <masiina/flags.hpp>
 #include <masiina/version.hpp>
 #include <peelo/unicode/encoding/utf8.hpp>
-#include <plorth/parser.hpp>
 
 namespace masiina::compiler
 {
-  unit::unit() {}
+  unit::unit()
+    : m_strip(false)
+    , m_compress(false) {}
 
   unit::unit(const unit& that)
     : m_symbol_map(that.m_symbol_map)
-    , m_modules(that.m_modules) {}
+    , m_modules(that.m_modules)
+    , m_cache_directory(that.m_cache_directory)
+    , m_strip(that.m_strip)
+    , m_compress(that.m_compress) {}
 
   unit&
   unit::operator=(const unit& that)
   {
     m_symbol_map = that.m_symbol_map;
     m_modules = that.m_modules;
+    m_cache_directory = that.m_cache_directory;
+    m_strip = that.m_strip;
+    m_compress = that.m_compress;
 
     return *this;
   }
 
-  std::optional<std::string>
-  unit::compile_file(const std::string& path)
+  void
+  unit::cache_directory(const std::string& directory)
+  {
+    m_cache_directory = directory;
+  }
+
+  void
+  unit::strip(bool strip)
+  {
+    m_strip = strip;
+  }
+
+  void
+  unit::compress(bool compress)
+  {
+    m_compress = compress;
+  }
+
+  static std::optional<std::string>
+  parse_file(
+    const std::string& path,
+    const std::optional<std::string>& cache_directory,
+    module& result
+  )
   {
-    const auto decoded_path = peelo::unicode::encoding::utf8::decode(path);
     const auto raw_source = io::read_file_contents(path);
-    std::u32string source;
-    plorth::parser::position position = { decoded_path, 1, 0 };
 
     if (!raw_source)
     {
@@ -67,50 +100,541 @@ namespace masiina::compiler
       );
     }
 
-    if (!peelo::unicode::encoding::utf8::decode_validate(*raw_source, source))
+    result = module(peelo::unicode::encoding::utf8::decode(path));
+
+    if (cache_directory)
+    {
+      const auto key = cache::make_key(path, *raw_source);
+
+      if (const auto entry = cache::load(*cache_directory, key))
+      {
+        result.cached(key, entry, *raw_source);
+
+        return std::nullopt;
+      }
+      result.cache_key(key);
+    }
+
+    return result.parse(*raw_source);
+  }
+
+  std::optional<std::string>
+  unit::compile_file(const std::string& path)
+  {
+    module result;
+
+    if (const auto error = parse_file(path, m_cache_directory, result))
+    {
+      return error;
+    }
+    m_modules.push_back(result);
+
+    return std::nullopt;
+  }
+
+  std::optional<std::string>
+  unit::compile_files(const std::vector<std::string>& paths, std::size_t jobs)
+  {
+    const auto count = paths.size();
+    std::vector<module> results(count);
+    std::vector<std::optional<std::string>> errors(count);
+
+    parallel_for(count, jobs, [&](std::size_t i)
+    {
+      errors[i] = parse_file(paths[i], m_cache_directory, results[i]);
+    });
+
+    for (const auto& error : errors)
+    {
+      if (error)
+      {
+        return error;
+      }
+    }
+    m_modules.insert(std::end(m_modules), std::begin(results), std::end(results));
+
+    return std::nullopt;
+  }
+
+  /**
+   * Compresses bytecode or debug info of an module. Decompressed size of the
+   * data precedes the compressed data.
+   */
+  static std::vector<unsigned char>
+  compress_section(const std::vector<unsigned char>& data)
+  {
+    std::vector<unsigned char> result;
+
+    io::write_uint32(result, static_cast<std::uint32_t>(data.size()));
+    compression::compress(data.data(), data.size(), result);
+
+    return result;
+  }
+
+  /**
+   * Decompresses bytecode or debug info of an module which occupies given
+   * range of the input. Returns false if the data is malformed.
+   */
+  static bool
+  decompress_section(
+    const std::string& input,
+    std::size_t offset,
+    std::size_t length,
+    std::vector<unsigned char>& output
+  )
+  {
+    const auto end = offset + length;
+    std::uint32_t size;
+
+    // No byte of compressed data decompresses into more than 255 bytes,
+    // which limits how large the size can be.
+    if (!io::read_uint32(input, offset, size)
+        || offset > end
+        || size / 255 > end - offset)
+    {
+      return false;
+    }
+    output.resize(size);
+
+    return compression::decompress(
+      reinterpret_cast<const unsigned char*>(input.data()) + offset,
+      end - offset,
+      output.data(),
+      size
+    );
+  }
+
+  static std::optional<std::string>
+  check_header(
+    const std::string& input,
+    std::size_t& offset,
+    unsigned char& flags
+  )
+  {
+    if (input.length() < 7
+        || input[0] != 'R'
+        || input[1] != 'j'
+        || input[2] != 'L')
+    {
+      return std::make_optional<std::string>("Magic number mismatch.");
+    }
+
+    const auto minor = static_cast<unsigned char>(input[4]);
+    const auto major = static_cast<unsigned char>(input[5]);
+
+    // The bytecode is rewritten rather than just copied, so it has to be in
+    // the format that this version of the compiler produces.
+    if (major != MASIINA_VERSION_MAJOR
+        || minor < MASIINA_MINIMUM_VERSION_MINOR
+        || minor > MASIINA_VERSION_MINOR)
+    {
+      return std::make_optional<std::string>("Incompatible version number.");
+    }
+
+    flags = static_cast<unsigned char>(input[6]);
+    if (flags & ~(flags::debug_info | flags::compressed))
+    {
+      return std::make_optional<std::string>("Unsupported flags.");
+    }
+    offset = 7;
+
+    return std::nullopt;
+  }
+
+  std::optional<std::string>
+  unit::link_file(const std::string& path)
+  {
+    auto input = io::read_file_contents(path);
+    std::size_t offset;
+    std::uint32_t symbol_count;
+    std::uint32_t module_count;
+    std::vector<std::uint32_t> mapping;
+    std::vector<std::u32string> names;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> ranges;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> debug_ranges;
+    std::vector<module> results;
+    unsigned char flags;
+    std::size_t entry_size;
+    std::size_t section;
+
+    if (!input)
     {
       return std::make_optional<std::string>(
-        "Unable to decode contents of `"
+        "Unable to open file `"
         + path
-        + "' with UTF-8 character encoding."
+        + "' for reading: "
+        + std::strerror(errno)
       );
     }
 
-    auto begin = std::cbegin(source);
-    const auto end = std::cend(source) - 1;
-    const auto result = plorth::parser::parse(begin, end, position);
+    if (const auto error = check_header(*input, offset, flags))
+    {
+      return std::make_optional<std::string>(path + ": " + *error);
+    }
 
-    if (result)
+    // Symbols of the linked unit are added into the symbol table of this
+    // one, which yields mapping from the old indexes into the new ones.
+    // Symbols which are contained in both are stored only once.
+    if (!io::read_uint32(*input, offset, symbol_count)
+        || input->length() - offset < symbol_count)
+    {
+      return std::make_optional<std::string>(
+        path + ": Unable to process symbol table."
+      );
+    }
+    mapping.reserve(symbol_count);
+    for (std::uint32_t i = 0; i < symbol_count; ++i)
     {
-      m_modules.emplace_back(decoded_path, *result.value());
-    } else {
-      const auto& error = result.error();
-      std::string message;
+      std::u32string symbol;
 
-      if (error)
+      if (!io::read_string(*input, offset, symbol))
       {
-        message =
-          peelo::unicode::encoding::utf8::encode(error->position.file)
-          + ":"
-          + std::to_string(error->position.line)
-          + ":"
-          + std::to_string(error->position.column)
-          + ": "
-          + peelo::unicode::encoding::utf8::encode(error->message);
-      } else {
-        message = "Unknown error.";
+        return std::make_optional<std::string>(
+          path + ": Unable to process symbol table."
+        );
       }
+      mapping.push_back(m_symbol_map.add(symbol));
+    }
 
-      return std::make_optional<std::string>(message);
+    // Directory entries contain location of the debug info only when the
+    // unit has one.
+    entry_size = flags & flags::debug_info ? 20 : 12;
+    if (!io::read_uint32(*input, offset, module_count)
+        || (input->length() - offset) / entry_size < module_count)
+    {
+      return std::make_optional<std::string>(
+        path + ": Unable to process module directory."
+      );
     }
+    section = offset + module_count * entry_size;
+    for (std::uint32_t i = 0; i < module_count; ++i)
+    {
+      const auto section_size = input->length() - section;
+      std::uint32_t name;
+      std::uint32_t module_offset;
+      std::uint32_t length;
+      std::uint32_t debug_offset = 0;
+      std::uint32_t debug_length = 0;
+
+      io::read_uint32(*input, offset, name);
+      io::read_uint32(*input, offset, module_offset);
+      io::read_uint32(*input, offset, length);
+      if (flags & flags::debug_info)
+      {
+        io::read_uint32(*input, offset, debug_offset);
+        io::read_uint32(*input, offset, debug_length);
+      }
+      if (name >= symbol_count
+          || module_offset > section_size
+          || length > section_size - module_offset
+          || debug_offset > section_size
+          || debug_length > section_size - debug_offset)
+      {
+        return std::make_optional<std::string>(
+          path + ": Unable to process module directory."
+        );
+      }
+      names.push_back(m_symbol_map.symbols()[mapping[name]]);
+      ranges.emplace_back(module_offset, length);
+      debug_ranges.emplace_back(debug_offset, debug_length);
+    }
+
+    for (std::uint32_t i = 0; i < module_count; ++i)
+    {
+      const auto begin = std::begin(*input) + section + ranges[i].first;
+      const auto debug_begin =
+        std::begin(*input) + section + debug_ranges[i].first;
+      std::vector<unsigned char> bytecode;
+      std::vector<unsigned char> debug_info;
+      auto relocated_bytecode = std::make_shared<std::vector<unsigned char>>();
+      std::shared_ptr<std::vector<unsigned char>> relocated_debug_info;
+
+      for (const auto& module : m_modules)
+      {
+        if (module.name() == names[i])
+        {
+          return std::make_optional<std::string>(
+            path
+            + ": Module `"
+            + peelo::unicode::encoding::utf8::encode(names[i])
+            + "' is already contained in the compilation unit."
+          );
+        }
+      }
+
+      if (!(flags & flags::compressed))
+      {
+        bytecode.assign(begin, begin + ranges[i].second);
+        debug_info.assign(debug_begin, debug_begin + debug_ranges[i].second);
+      }
+      else if (!decompress_section(
+                 *input,
+                 section + ranges[i].first,
+                 ranges[i].second,
+                 bytecode
+               )
+               || ((flags & flags::debug_info)
+                 && !decompress_section(
+                   *input,
+                   section + debug_ranges[i].first,
+                   debug_ranges[i].second,
+                   debug_info
+                 )))
+      {
+        return std::make_optional<std::string>(
+          path
+          + ": Unable to decompress module `"
+          + peelo::unicode::encoding::utf8::encode(names[i])
+          + "'."
+        );
+      }
+
+      if (flags & flags::debug_info)
+      {
+        relocated_debug_info = std::make_shared<std::vector<unsigned char>>();
+      }
+
+      if (!relocate(bytecode, mapping, *relocated_bytecode)
+          || (relocated_debug_info
+              && !relocate_debug_info(
+                debug_info,
+                mapping,
+                *relocated_debug_info
+              )))
+      {
+        return std::make_optional<std::string>(
+          path
+          + ": Unable to relocate module `"
+          + peelo::unicode::encoding::utf8::encode(names[i])
+          + "'."
+        );
+      }
+      results.emplace_back(names[i]);
+      results.back().linked(relocated_bytecode, relocated_debug_info);
+    }
+    m_modules.insert(std::end(m_modules), std::begin(results), std::end(results));
 
     return std::nullopt;
   }
 
-  void
-  unit::write(FILE* output)
+  std::optional<std::string>
+  unit::write(FILE* output, std::size_t jobs)
   {
-    std::vector<std::vector<unsigned char>> modules;
+    const auto count = m_modules.size();
+    std::unordered_set<std::u32string> declared_words;
+    std::vector<std::uint32_t> names;
+    std::vector<std::vector<std::u32string>> local_symbols(count);
+    std::vector<std::vector<unsigned char>> local_modules(count);
+    std::vector<std::vector<unsigned char>> local_debug_infos(count);
+    std::vector<std::vector<std::uint32_t>> mappings(count);
+    std::vector<std::vector<unsigned char>> modules(count);
+    std::vector<std::vector<unsigned char>> debug_infos(count);
+    std::vector<std::optional<std::string>> errors(count);
+    std::vector<std::optional<std::string>> cache_errors(count);
+    std::unordered_set<std::string> reported_cache_errors;
+    std::vector<char> relocated(count);
+    std::vector<unsigned char> payload;
+    unsigned char flags = 0;
+    std::uint32_t offset = 0;
+    std::uint32_t debug_offset = 0;
+
+    // Words declared by any module of the compilation unit could end up in
+    // scope of any other module through an import.
+    for (const auto& module : m_modules)
+    {
+      module.collect_declared_words(declared_words);
+    }
+
+    parallel_for(count, jobs, [&](std::size_t i)
+    {
+      auto& module = m_modules[i];
+      symbol_map local_symbol_map;
+      dependency_map dependencies;
+
+      // Bytecode of linked modules already refers to the symbol table of the
+      // compilation unit.
+      if (module.linked_bytecode())
+      {
+        return;
+      }
+
+      // Cached bytecode can be used as long as none of the builtin words or
+      // number literals referenced by the module have been declared as words
+      // by other modules since, or vice versa.
+      if (const auto& entry = module.cache_entry())
+      {
+        if (entry->is_valid(declared_words))
+        {
+          local_symbols[i] = entry->symbols;
+          local_modules[i] = entry->bytecode;
+          local_debug_infos[i] = entry->debug_info;
+          return;
+        }
+        else if ((errors[i] = module.parse_cached_source()))
+        {
+          return;
+        }
+      }
+
+      local_modules[i] = module.compile(
+        local_symbol_map,
+        declared_words,
+        m_cache_directory ? &dependencies : nullptr,
+        &local_debug_infos[i]
+      );
+      local_symbols[i] = local_symbol_map.symbols();
+
+      if (m_cache_directory && module.cache_key())
+      {
+        std::unordered_set<std::u32string> module_declared_words;
+        cache::entry entry;
+
+        module.collect_declared_words(module_declared_words);
+        entry.declared_words.assign(
+          std::begin(module_declared_words),
+          std::end(module_declared_words)
+        );
+        std::sort(std::begin(entry.declared_words), std::end(entry.declared_words));
+        entry.dependencies.assign(
+          std::begin(dependencies),
+          std::end(dependencies)
+        );
+        entry.symbols = local_symbols[i];
+        entry.bytecode = local_modules[i];
+        entry.debug_info = local_debug_infos[i];
+        cache_errors[i] = cache::store(
+          *m_cache_directory,
+          *module.cache_key(),
+          entry
+        );
+      }
+    });
+    for (const auto& error : errors)
+    {
+      if (error)
+      {
+        return error;
+      }
+    }
+
+    // Cache is only an optimization, so failing to store an module into it
+    // doesn't prevent using the bytecode which was just compiled. Modules
+    // usually fail for the same reason, which is reported only once.
+    for (const auto& error : cache_errors)
+    {
+      if (error && reported_cache_errors.insert(*error).second)
+      {
+        std::cerr << "Warning: " << *error << std::endl;
+      }
+    }
+
+    // Symbols of each module are added into the symbol table of the unit in
+    // the order of their first occurrence, which results in the same symbol
+    // table as compiling the modules one after another would.
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      names.push_back(m_symbol_map.add(m_modules[i].name()));
+      for (const auto& symbol : local_symbols[i])
+      {
+        mappings[i].push_back(m_symbol_map.add(symbol));
+      }
+    }
+
+    parallel_for(count, jobs, [&](std::size_t i)
+    {
+      const auto& module = m_modules[i];
+
+      if (const auto& bytecode = module.linked_bytecode())
+      {
+        modules[i] = *bytecode;
+        if (!m_strip && module.linked_debug_info())
+        {
+          debug_infos[i] = *module.linked_debug_info();
+        }
+        relocated[i] = true;
+      } else {
+        relocated[i] = relocate(local_modules[i], mappings[i], modules[i])
+          && (m_strip || relocate_debug_info(
+            local_debug_infos[i],
+            mappings[i],
+            debug_infos[i]
+          ));
+      }
+    });
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      if (!relocated[i])
+      {
+        return std::make_optional<std::string>(
+          "Unable to relocate module `"
+          + peelo::unicode::encoding::utf8::encode(m_modules[i].name())
+          + "'."
+        );
+      }
+    }
+
+    // Bytecode and debug info of each module are compressed separately, so
+    // that the runtime can decompress modules one at a time as they are
+    // imported, instead of the whole unit at once.
+    if (m_compress)
+    {
+      parallel_for(count, jobs, [&](std::size_t i)
+      {
+        modules[i] = compress_section(modules[i]);
+        if (!m_strip)
+        {
+          debug_infos[i] = compress_section(debug_infos[i]);
+        }
+      });
+    }
+
+    // Symbol table.
+    m_symbol_map.write(payload);
+
+    // Module directory, which contains name of each module along with offset
+    // and length of it's bytecode, so that the runtime can decode modules on
+    // demand. Unless the unit is stripped, offset and length of the debug
+    // info of each module follow. Debug info is placed after all of the
+    // modules, so that it isn't read from the disk unless it's needed.
+    io::write_uint32(payload, static_cast<std::uint32_t>(modules.size()));
+    for (const auto& module : modules)
+    {
+      debug_offset += static_cast<std::uint32_t>(module.size());
+    }
+    for (std::size_t i = 0; i < modules.size(); ++i)
+    {
+      const auto length = static_cast<std::uint32_t>(modules[i].size());
+
+      io::write_uint32(payload, names[i]);
+      io::write_uint32(payload, offset);
+      io::write_uint32(payload, length);
+      offset += length;
+      if (!m_strip)
+      {
+        const auto debug_length = static_cast<std::uint32_t>(
+          debug_infos[i].size()
+        );
+
+        io::write_uint32(payload, debug_offset);
+        io::write_uint32(payload, debug_length);
+        debug_offset += debug_length;
+      }
+    }
+
+    // All modules contained in the compilation unit, followed by their
+    // debug info.
+    for (const auto& module : modules)
+    {
+      payload.insert(std::end(payload), std::begin(module), std::end(module));
+    }
+    for (const auto& debug_info : debug_infos)
+    {
+      payload.insert(
+        std::end(payload),
+        std::begin(debug_info),
+        std::end(debug_info)
+      );
+    }
 
     // Magic number.
     std::fputs("RjL", output);
@@ -120,24 +644,32 @@ namespace masiina::compiler
     std::fputc(MASIINA_VERSION_MINOR, output);
     std::fputc(MASIINA_VERSION_MAJOR, output);
 
-    for (const auto& module : m_modules)
+    // Flags.
+    if (!m_strip)
+    {
+      flags |= flags::debug_info;
+    }
+    if (m_compress)
     {
-      modules.push_back(module.compile(m_symbol_map));
+      flags |= flags::compressed;
     }
+    std::fputc(flags, output);
 
-    // Symbol table.
-    m_symbol_map.write(output);
+    std::fwrite(
+      static_cast<const void*>(payload.data()),
+      payload.size(),
+      1,
+      output
+    );
 
-    // All modules contained in the compilation unit.
-    io::write_uint32(output, static_cast<std::uint32_t>(modules.size()));
-    for (const auto& module : modules)
+    if (std::ferror(output))
     {
-      std::fwrite(
-        static_cast<const void*>(module.data()),
-        module.size(),
-        1,
-        output
+      return std::make_optional<std::string>(
+        std::string("Unable to write compilation unit: ")
+        + std::strerror(errno)
       );
     }
+
+    return std::nullopt;
   }
 }
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <cstddef>
+
+namespace masiina::builtins
+{
+  /**
+   * Words of the Plorth prelude which the compiler resolves into builtin
+   * indexes. Indexes are part of the bytecode format, so new words must
+   * only be appended to the end of the table. Runtime calls these words
+   * without looking at the prototype of the topmost value of the stack
+   * unless it's an object, so none of them may be defined by the
+   * prototypes of other types.
+   */
+  inline constexpr const char32_t* words[] =
+  {
+    U"nop",
+    U"clear",
+    U"depth",
+    U"drop",
+    U"2drop",
+    U"dup",
+    U"2dup",
+    U"nip",
+    U"over",
+    U"rot",
+    U"swap",
+    U"tuck",
+    U"if",
+    U"if-else",
+    U"while",
+    U"try",
+    U"try-else",
+    U"typeof",
+    U"emit",
+    U"print",
+    U"println",
+  };
+
+  inline constexpr std::size_t count = sizeof(words) / sizeof(words[0]);
+}
@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+ * Compression of compilation units with a simple LZ77 family codec, which
+ * favors decompression speed over compression ratio.
+ *
+ * Compressed data is a sequence of sequences, each of which begins with a
+ * token byte. High four bits of the token contain number of literal bytes
+ * which follow and low four bits contain length of the match which follows
+ * the literals, minus the minimum match length. When either of the lengths
+ * is 15, it's continued in the following bytes, each of which is added to
+ * the length until a byte smaller than 255 is encountered. Match is encoded
+ * as 16-bit little endian distance back into the decompressed data, followed
+ * by the continuation of the match length. Last sequence contains only
+ * literals.
+ */
+namespace masiina::compression
+{
+  inline constexpr std::size_t min_match_length = 4;
+  inline constexpr std::size_t max_distance = 65535;
+  inline constexpr int hash_bits = 16;
+
+  inline std::uint32_t
+  read_uint32(const unsigned char* data)
+  {
+    std::uint32_t value;
+
+    std::memcpy(static_cast<void*>(&value), data, sizeof(value));
+
+    return value;
+  }
+
+  inline std::uint32_t
+  hash(std::uint32_t value)
+  {
+    return (value * 2654435761U) >> (32 - hash_bits);
+  }
+
+  inline void
+  write_length(std::vector<unsigned char>& output, std::size_t length)
+  {
+    for (; length >= 255; length -= 255)
+    {
+      output.push_back(255);
+    }
+    output.push_back(static_cast<unsigned char>(length));
+  }
+
+  inline void
+  write_sequence(
+    std::vector<unsigned char>& output,
+    const unsigned char* literals,
+    std::size_t literal_length,
+    std::size_t distance,
+    std::size_t match_length
+  )
+  {
+    const auto match_token = match_length
+      ? match_length - min_match_length
+      : 0;
+
+    output.push_back(static_cast<unsigned char>(
+      ((literal_length < 15 ? literal_length : 15) << 4)
+      | (match_token < 15 ? match_token : 15)
+    ));
+    if (literal_length >= 15)
+    {
+      write_length(output, literal_length - 15);
+    }
+    output.insert(std::end(output), literals, literals + literal_length);
+    if (!match_length)
+    {
+      return;
+    }
+    output.push_back(static_cast<unsigned char>(distance & 0xff));
+    output.push_back(static_cast<unsigned char>(distance >> 8));
+    if (match_token >= 15)
+    {
+      write_length(output, match_token - 15);
+    }
+  }
+
+  /**
+   * Compresses given data and appends the result into given vector.
+   */
+  inline void
+  compress(
+    const unsigned char* data,
+    std::size_t size,
+    std::vector<unsigned char>& output
+  )
+  {
+    std::vector<std::uint32_t> table(std::size_t(1) << hash_bits, 0);
+    std::size_t anchor = 0;
+    std::size_t position = 0;
+
+    output.reserve(output.size() + size / 2);
+
+    // Positions in the hash table are stored with offset of one, so that
+    // zero means an empty slot.
+    while (size >= min_match_length
+           && position <= size - min_match_length)
+    {
+      const auto value = read_uint32(data + position);
+      auto& slot = table[hash(value)];
+      const std::size_t candidate = slot;
+      std::size_t length;
+
+      slot = static_cast<std::uint32_t>(position + 1);
+      if (!candidate
+          || position - (candidate - 1) > max_distance
+          || read_uint32(data + candidate - 1) != value)
+      {
+        ++position;
+        continue;
+      }
+
+      length = min_match_length;
+      while (position + length < size
+             && data[candidate - 1 + length] == data[position + length])
+      {
+        ++length;
+      }
+
+      write_sequence(
+        output,
+        data + anchor,
+        position - anchor,
+        position - (candidate - 1),
+        length
+      );
+      position += length;
+      anchor = position;
+    }
+
+    write_sequence(output, data + anchor, size - anchor, 0, 0);
+  }
+
+  inline bool
+  read_length(
+    const unsigned char*& input,
+    const unsigned char* input_end,
+    std::size_t& length
+  )
+  {
+    unsigned char byte;
+
+    do
+    {
+      if (input >= input_end)
+      {
+        return false;
+      }
+      byte = *input++;
+      length += byte;
+    }
+    while (byte == 255);
+
+    return true;
+  }
+
+  /**
+   * Decompresses given data into given output buffer, in a single pass
+   * without any intermediate buffers. Returns false if the data is
+   * malformed or it doesn't decompress into exactly the size of the output
+   * buffer.
+   */
+  inline bool
+  decompress(
+    const unsigned char* input,
+    std::size_t input_size,
+    unsigned char* output,
+    std::size_t output_size
+  )
+  {
+    const auto input_end = input + input_size;
+    const auto output_begin = output;
+    const auto output_end = output + output_size;
+
+    while (input < input_end)
+    {
+      const auto token = *input++;
+      std::size_t literal_length = token >> 4;
+      std::size_t match_length = token & 0x0f;
+      std::size_t distance;
+
+      if (literal_length == 15
+          && !read_length(input, input_end, literal_length))
+      {
+        return false;
+      }
+      if (static_cast<std::size_t>(input_end - input) < literal_length
+          || static_cast<std::size_t>(output_end - output) < literal_length)
+      {
+        return false;
+      }
+      std::memcpy(output, input, literal_length);
+      input += literal_length;
+      output += literal_length;
+
+      // Last sequence contains only literals.
+      if (input == input_end)
+      {
+        break;
+      }
+
+      if (input_end - input < 2)
+      {
+        return false;
+      }
+      distance = static_cast<std::size_t>(input[0])
+        | (static_cast<std::size_t>(input[1]) << 8);
+      input += 2;
+      if (match_length == 15 && !read_length(input, input_end, match_length))
+      {
+        return false;
+      }
+      match_length += min_match_length;
+      if (!distance
+          || static_cast<std::size_t>(output - output_begin) < distance
+          || static_cast<std::size_t>(output_end - output) < match_length)
+      {
+        return false;
+      }
+
+      // Matches which overlap the data being written have to be copied one
+      // byte at a time, as they repeat the bytes they produce.
+      if (distance >= match_length)
+      {
+        std::memcpy(output, output - distance, match_length);
+        output += match_length;
+      } else {
+        const auto end = output + match_length;
+
+        for (; output < end; ++output)
+        {
+          *output = *(output - distance);
+        }
+      }
+    }
+
+    return output == output_end;
+  }
+}
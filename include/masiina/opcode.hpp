@@ -30,12 +30,15 @@ namespace masiina::opcode
   enum
   {
     push_array = '[',
+    push_integer = 'i',
     push_object = '{',
     push_quote = '(',
+    push_real = 'r',
     push_string = '"',
     push_string_const = '\'',
     push_symbol = 's',
     push_symbol_const = 'S',
+    call_builtin = 'B',
     declare_word = ':',
   };
 }
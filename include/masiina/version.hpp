@@ -26,5 +26,10 @@
 #pragma once
 
 #define MASIINA_VERSION_MAJOR 1
-#define MASIINA_VERSION_MINOR 0
+#define MASIINA_VERSION_MINOR 4
 #define MASIINA_VERSION_PATCH 0
+
+// Oldest version of the compiler whose compilation units can be loaded by the
+// runtime.
+#define MASIINA_MINIMUM_VERSION_MAJOR 1
+#define MASIINA_MINIMUM_VERSION_MINOR 3
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <deque>
+
+#include <masiina/macros.hpp>
+#include <plorth/context.hpp>
+
+namespace masiina::runtime
+{
+  class environment;
+  class routine;
+
+  /**
+   * Bounded buffer through which routines of an environment can exchange
+   * values. Routine which tries to send values into an full channel, or
+   * receive values from an empty one, is parked until the channel has room
+   * or values available again.
+   *
+   * In Plorth code channels are represented by objects whose methods refer
+   * to the channel, so the channel lives only as long as those objects are
+   * referenced.
+   */
+  class channel
+  {
+  public:
+    explicit channel(class environment& environment, std::size_t capacity);
+
+    inline std::size_t capacity() const
+    {
+      return m_capacity;
+    }
+
+    inline bool is_closed() const
+    {
+      return m_closed;
+    }
+
+    /**
+     * Inserts given value into the channel, parking given routine until
+     * there is room for it. Returns false and sets error to context of the
+     * routine if the channel has been closed.
+     */
+    bool send(routine& sender, const std::shared_ptr<plorth::value>& value);
+
+    /**
+     * Removes the oldest value from the channel, parking given routine
+     * until there is one available. Returns null if the channel has been
+     * closed and all of it's values have been received.
+     */
+    std::shared_ptr<plorth::value> receive(routine& receiver);
+
+    /**
+     * Closes the channel, waking up all routines which are waiting for it.
+     * Values which have already been sent can still be received.
+     */
+    void close();
+
+  private:
+    void wake_one(std::deque<std::shared_ptr<routine>>& queue);
+    void wake_all(std::deque<std::shared_ptr<routine>>& queue);
+
+    DISALLOW_COPY_AND_ASSIGN(channel);
+
+  private:
+    class environment& m_environment;
+    const std::size_t m_capacity;
+    bool m_closed;
+    std::deque<std::shared_ptr<plorth::value>> m_buffer;
+    std::deque<std::shared_ptr<routine>> m_waiting_senders;
+    std::deque<std::shared_ptr<routine>> m_waiting_receivers;
+  };
+}
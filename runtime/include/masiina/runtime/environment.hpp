@@ -25,12 +25,27 @@
  */
 #pragma once
 
+#include <deque>
+#include <ostream>
+#include <unordered_map>
+
 #include <masiina/runtime/module.hpp>
+#include <masiina/runtime/profiler.hpp>
+#include <masiina/runtime/reactor.hpp>
+#include <masiina/runtime/timer_wheel.hpp>
 #include <masiina/runtime/routine.hpp>
+#include <masiina/runtime/statistics.hpp>
 #include <plorth/runtime.hpp>
 
 namespace masiina::runtime
 {
+  /**
+   * Environment in which routines of an program are executed. Routines are
+   * stepped one at a time in the thread which calls step(), as neither the
+   * Plorth runtime nor it's memory manager are thread safe, and routines
+   * share values with each other. Programs which need to use multiple
+   * processor cores have to be run in multiple processes.
+   */
   class environment : public plorth::module::manager
   {
   public:
@@ -39,6 +54,10 @@ namespace masiina::runtime
       std::shared_ptr<plorth::object>
     >;
 
+    // Number of steps after which routines waiting for I/O are checked, when
+    // there are other routines to run.
+    static constexpr std::size_t poll_interval = 64;
+
     explicit environment();
 
     inline const std::shared_ptr<plorth::runtime>& runtime() const
@@ -46,28 +65,255 @@ namespace masiina::runtime
       return m_runtime;
     }
 
+    /**
+     * Returns the quantum used for routines which don't have one of their
+     * own.
+     */
+    inline const struct quantum& default_quantum() const
+    {
+      return m_default_quantum;
+    }
+
+    inline void default_quantum(const struct quantum& quantum)
+    {
+      m_default_quantum = quantum;
+    }
+
+    /**
+     * Returns the size in bytes of the stack allocated for each routine.
+     * Plorth code recurses on the stack of the routine executing it, so
+     * deeply recursive programs crash unless the stack is large enough.
+     * Default is one megabyte.
+     */
+    inline std::size_t stack_size() const
+    {
+      return m_stack_size;
+    }
+
+    inline void stack_size(std::size_t size)
+    {
+      m_stack_size = size;
+    }
+
+    /**
+     * Returns boolean flag indicating whether quotes which reference
+     * builtin words are decoded into native quotes which call the builtin
+     * words directly, see module::decode(). Quotes are never bound while
+     * profiling. Default is true.
+     */
+    inline bool bind_quotes() const
+    {
+      return m_bind_quotes;
+    }
+
+    inline void bind_quotes(bool bind_quotes)
+    {
+      m_bind_quotes = bind_quotes;
+    }
+
+    inline class reactor& reactor()
+    {
+      return m_reactor;
+    }
+
+    inline class timer_wheel& timers()
+    {
+      return m_timers;
+    }
+
+    /**
+     * Returns boolean flag indicating whether there are routines waiting for
+     * I/O or timers, which will become runnable at some point even if no
+     * other routine wakes them up.
+     */
+    inline bool has_pending_events() const
+    {
+      return m_reactor.waiting_count() > 0 || m_timers.size() > 0;
+    }
+
+    /**
+     * Returns the number of milliseconds until the next timer expires, or
+     * -1 if there are no timers.
+     */
+    int poll_timeout();
+
+    /**
+     * Wakes up routines whose timers have expired.
+     */
+    void wake_expired_timers();
+
+    /**
+     * Parks given routine until given duration has elapsed. Must be called
+     * from the routine itself.
+     */
+    void sleep(routine& routine, std::chrono::milliseconds duration);
+
+    /**
+     * Returns buffers which contain data read from file descriptors that
+     * hasn't been consumed yet, keyed by the file descriptors.
+     */
+    inline std::unordered_map<int, std::string>& input_buffers()
+    {
+      return m_input_buffers;
+    }
+
+    inline struct statistics& statistics()
+    {
+      return m_statistics;
+    }
+
+    /**
+     * Sets the profiler used for instrumenting modules as they are decoded.
+     */
+    inline void profiler(class profiler* profiler)
+    {
+      m_profiler = profiler;
+    }
+
+    /**
+     * Sets the stream into which errors of routines are reported. Null
+     * pointer disables reporting, in which case errors can still be
+     * retrieved from the routines themselves. Defaults to standard error.
+     */
+    inline void error_output(std::ostream* output)
+    {
+      m_error_output = output;
+    }
+
+    /**
+     * Formats given error into an message which includes position of the
+     * error, if it's known. Position comes from the symbol which raised the
+     * error, which has it only if the compilation unit wasn't stripped of
+     * debug info.
+     */
+    static std::string format_error(const std::shared_ptr<plorth::error>& error);
+
     void add_imported_module(const std::shared_ptr<module>& module);
 
-    bool is_finished() const;
+    /**
+     * Returns modules which have been imported so far, keyed by their
+     * names.
+     */
+    inline const module_cache_type& module_cache() const
+    {
+      return m_module_cache;
+    }
+
+    /**
+     * Returns hash of the compilation unit from which the imported modules
+     * were loaded, or nothing if no modules have been added.
+     */
+    std::optional<std::uint64_t> unit_hash() const;
 
-    void spawn(const std::vector<std::shared_ptr<plorth::value>>& values);
+    /**
+     * Loads modules from an snapshot written with snapshot::write(). Modules
+     * contained in the snapshot are imported by declaring their words,
+     * without executing the modules themselves. Returns an error message if
+     * the snapshot cannot be loaded, or if it was taken from another
+     * compilation unit than the one from which the modules were loaded.
+     */
+    std::optional<std::string> load_snapshot(const std::string& path);
 
+    /**
+     * Decodes values of given module, unless that has already been done, and
+     * instruments them if profiling is enabled. Returns an error message if
+     * the module cannot be decoded.
+     */
+    std::optional<std::string> decode_module(
+      const std::shared_ptr<module>& module
+    );
+
+    /**
+     * Returns boolean flag indicating whether all routines of the
+     * environment have finished.
+     */
+    inline bool is_finished() const
+    {
+      return !m_live_routines;
+    }
+
+    /**
+     * Creates new routine which executes given values and inserts it into
+     * the run queue. If no context is given, the routine will be given an
+     * new empty context.
+     */
+    std::shared_ptr<routine> spawn(
+      const std::vector<std::shared_ptr<plorth::value>>& values,
+      const std::shared_ptr<plorth::context>& context = nullptr
+    );
+
+    /**
+     * Creates new routine which executes values of given module, which
+     * must have been decoded, and inserts it into the run queue. References
+     * to builtin words made by the module are called directly.
+     */
+    std::shared_ptr<routine> spawn(
+      const std::shared_ptr<module>& module,
+      const std::shared_ptr<plorth::context>& context = nullptr
+    );
+
+    /**
+     * Inserts given parked routine back into the run queue. Does nothing if
+     * the routine isn't parked.
+     */
+    void wake(const std::shared_ptr<routine>& routine);
+
+    /**
+     * Steps the routine at the front of the run queue, after which it's
+     * either moved to the back of the run queue, or discarded if it has
+     * finished or parked. Routines waiting for I/O or timers are resumed
+     * every now and then, and if there are no runnable routines, blocks
+     * until some of them can be resumed. Returns true if an error occurred in the routine,
+     * or if all remaining routines are parked and thus will never finish.
+     */
     bool step();
 
+    /**
+     * Steps given routine using it's own quantum, or the default quantum of
+     * the environment. Returns false if an error occurred, after it has
+     * been reported.
+     */
+    bool step(const std::shared_ptr<routine>& routine);
+
     virtual std::shared_ptr<plorth::object> import_module(
       const std::shared_ptr<plorth::context>& context,
       const std::u32string& path
     );
 
   private:
+    std::shared_ptr<routine> spawn(
+      const std::vector<std::shared_ptr<plorth::value>>& values,
+      const module::builtin_container_type& builtins,
+      const std::shared_ptr<plorth::context>& context
+    );
+    std::shared_ptr<plorth::object> import_snapshot_module(
+      const std::shared_ptr<plorth::context>& context,
+      const std::shared_ptr<module>& snapshot_module
+    );
+    void report_error(const std::shared_ptr<plorth::context>& context);
+    void report_deadlock();
+
     DISALLOW_COPY_AND_ASSIGN(environment);
 
+
   private:
     plorth::memory::manager m_memory_manager;
     const std::shared_ptr<plorth::runtime> m_runtime;
     std::unordered_map<std::u32string, std::shared_ptr<module>> m_imported_modules;
+    std::unordered_map<std::u32string, std::shared_ptr<module>> m_snapshot_modules;
     module_cache_type m_module_cache;
-    std::vector<std::shared_ptr<routine>> m_routines;
-    std::size_t m_routine_offset;
+    std::deque<std::shared_ptr<routine>> m_run_queue;
+    std::size_t m_live_routines;
+    routine::id_type m_last_routine_id;
+    struct quantum m_default_quantum;
+    std::size_t m_stack_size;
+    bool m_bind_quotes;
+    class reactor m_reactor;
+    class timer_wheel m_timers;
+    class profiler* m_profiler;
+    struct statistics m_statistics;
+    std::unordered_map<int, std::string> m_input_buffers;
+    std::size_t m_steps_since_poll;
+    std::ostream* m_error_output;
   };
 }
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <masiina/runtime/environment.hpp>
+#include <masiina/runtime/parser.hpp>
+
+namespace masiina::runtime
+{
+  /**
+   * Entry point for applications which embed the virtual machine. Host owns
+   * an environment into which an compilation unit is loaded once, after
+   * which the main module of the unit can be executed any number of times,
+   * each time in an routine of it's own, without having to load or decode
+   * the unit again. Imported modules are cached by the environment, so their
+   * top level code is executed only once as well.
+   */
+  class host
+  {
+  public:
+    using result_type = peelo::result<
+      std::vector<std::shared_ptr<plorth::value>>,
+      std::string
+    >;
+
+    explicit host();
+
+    inline class environment& environment()
+    {
+      return m_environment;
+    }
+
+    inline const std::shared_ptr<plorth::runtime>& runtime() const
+    {
+      return m_environment.runtime();
+    }
+
+    /**
+     * Returns boolean flag indicating whether an compilation unit has been
+     * loaded.
+     */
+    inline bool is_loaded() const
+    {
+      return !!m_main_module;
+    }
+
+    /**
+     * Loads compilation unit from given file. Returns an error message if
+     * the unit cannot be loaded or if an unit has already been loaded.
+     */
+    std::optional<std::string> load(const std::string& path);
+
+    /**
+     * Loads compilation unit from given bytecode. Unless the bytecode is
+     * copied, it must remain valid for as long as the host exists.
+     */
+    std::optional<std::string> load(
+      const unsigned char* data,
+      std::size_t size,
+      bool copy = true
+    );
+
+    /**
+     * Creates new routine which executes the main module of the loaded unit
+     * with given values on it's stack, and inserts it into the run queue.
+     * Returns null pointer if no unit has been loaded.
+     */
+    std::shared_ptr<routine> spawn(
+      const std::vector<std::shared_ptr<plorth::value>>& arguments = {}
+    );
+
+    /**
+     * Steps routines of the environment until all of them have finished, or
+     * until given number of steps has been taken. Zero means no limit.
+     * Returns boolean flag indicating whether all routines have finished.
+     * Errors of the routines can be retrieved with result().
+     */
+    bool run(std::size_t budget = 0);
+
+    /**
+     * Returns contents of the stack of given finished routine, or an error
+     * message if the routine failed or hasn't finished yet.
+     */
+    static result_type result(const std::shared_ptr<routine>& routine);
+
+  private:
+    std::optional<std::string> load(const parser::result_type& result);
+
+    DISALLOW_COPY_AND_ASSIGN(host);
+
+  private:
+    class environment m_environment;
+    std::shared_ptr<module> m_main_module;
+  };
+}
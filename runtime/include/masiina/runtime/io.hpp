@@ -26,11 +26,134 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include <masiina/macros.hpp>
 
 namespace masiina::runtime::io
 {
-  bool read_uint16(FILE* input, std::uint16_t& number);
-  bool read_uint32(FILE* input, std::uint32_t& number);
-  bool read_string(FILE* input, std::u32string& str);
+  /**
+   * Read only view to contents of an file. The contents are memory mapped
+   * when the platform supports it and the file is an regular file, otherwise
+   * they are read into an heap allocated buffer. Buffer can also refer to
+   * memory owned by someone else, in which case it's not copied at all.
+   */
+  class buffer
+  {
+  public:
+    /**
+     * Determines how the contents of the buffer are released.
+     */
+    enum class storage
+    {
+      // Contents have been allocated with malloc().
+      heap,
+      // Contents have been mapped with mmap().
+      mapped,
+      // Contents are owned by someone else, and are not released.
+      external
+    };
+
+    /**
+     * Opens given file and either maps or reads it's contents into memory.
+     * Path `-` refers to the standard input. Returns null pointer and leaves
+     * errno set if the file cannot be opened.
+     */
+    static std::shared_ptr<buffer> open(const std::string& path);
+
+    /**
+     * Copies given data into an heap allocated buffer. Returns null pointer
+     * if the memory cannot be allocated.
+     */
+    static std::shared_ptr<buffer> copy(
+      const unsigned char* data,
+      std::size_t size
+    );
+
+    /**
+     * Decompresses given data into an heap allocated buffer of given size.
+     * Returns null pointer if the data does not decompress into exactly
+     * that many bytes, or if the memory cannot be allocated.
+     */
+    static std::shared_ptr<buffer> decompress(
+      const unsigned char* data,
+      std::size_t size,
+      std::size_t decompressed_size
+    );
+
+    /**
+     * Wraps given memory into an buffer without copying it. The memory must
+     * remain valid for as long as the buffer is in use.
+     */
+    static std::shared_ptr<buffer> wrap(
+      const unsigned char* data,
+      std::size_t size
+    );
+
+    explicit buffer(
+      const unsigned char* data,
+      std::size_t size,
+      enum storage storage
+    );
+    ~buffer();
+
+    inline const unsigned char* data() const
+    {
+      return m_data;
+    }
+
+    inline std::size_t size() const
+    {
+      return m_size;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(buffer);
+
+  private:
+    const unsigned char* m_data;
+    const std::size_t m_size;
+    const enum storage m_storage;
+  };
+
+  /**
+   * Bounds checked position inside an buffer, from which the bytecode is
+   * being decoded.
+   */
+  struct cursor
+  {
+    const unsigned char* current;
+    const unsigned char* end;
+  };
+
+  bool read_byte(cursor& input, unsigned char& byte);
+  bool read_uint16(cursor& input, std::uint16_t& number);
+  bool read_uint32(cursor& input, std::uint32_t& number);
+  bool read_uint64(cursor& input, std::uint64_t& number);
+
+  /**
+   * Decodes LEB128 encoded unsigned integer, which is used for indexes,
+   * sizes and source code positions in the bytecode.
+   */
+  bool read_varint(cursor& input, std::uint32_t& number);
+
+  /**
+   * Decodes zigzag and LEB128 encoded signed integer.
+   */
+  bool read_svarint(cursor& input, std::int32_t& number);
+  bool read_string(cursor& input, std::u32string& str);
+
+  void write_uint16(std::vector<unsigned char>& output, std::uint16_t number);
+  void write_uint32(std::vector<unsigned char>& output, std::uint32_t number);
+  void write_uint64(std::vector<unsigned char>& output, std::uint64_t number);
+  void write_varint(std::vector<unsigned char>& output, std::uint32_t number);
+  void write_svarint(std::vector<unsigned char>& output, std::int32_t number);
+  void write_string(std::vector<unsigned char>& output, const std::u32string& str);
+
+  /**
+   * Computes 64-bit FNV-1a hash of given data.
+   */
+  std::uint64_t hash(const unsigned char* data, std::size_t size);
 }
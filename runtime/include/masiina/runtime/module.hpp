@@ -25,10 +25,13 @@
  */
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <optional>
 #include <vector>
 
 #include <masiina/macros.hpp>
-#include <plorth/value.hpp>
+#include <plorth/runtime.hpp>
 
 namespace masiina::runtime
 {
@@ -38,23 +41,123 @@ namespace masiina::runtime
     using value_type = std::shared_ptr<plorth::value>;
     using container_type = std::vector<value_type>;
 
+    /**
+     * Builtin word bound to the native quote of the word in the global
+     * dictionary of the runtime.
+     */
+    struct builtin
+    {
+      std::uint16_t index;
+      std::shared_ptr<plorth::quote> quote;
+    };
+
+    using builtin_container_type = std::vector<std::shared_ptr<const builtin>>;
+    using decoder_type = std::function<std::optional<std::string>(
+      const std::shared_ptr<plorth::runtime>&,
+      bool,
+      container_type&,
+      builtin_container_type&
+    )>;
+
     explicit module(const std::u32string& name, const container_type& values);
+    explicit module(
+      const std::u32string& name,
+      const decoder_type& decoder,
+      std::uint64_t unit_hash = 0
+    );
 
     inline const std::u32string& name() const
     {
       return m_name;
     }
 
+    /**
+     * Returns hash of the symbol table and module directory of the
+     * compilation unit from which the module was loaded. Modules loaded
+     * from an snapshot carry hash of the compilation unit from which the
+     * snapshot was taken instead.
+     */
+    inline std::uint64_t unit_hash() const
+    {
+      return m_unit_hash;
+    }
+
+    /**
+     * Returns boolean flag indicating whether values of the module have
+     * already been decoded from the bytecode.
+     */
+    inline bool is_decoded() const
+    {
+      return !m_decoder;
+    }
+
+    /**
+     * Decodes values of the module from the bytecode, unless that has
+     * already been done. Returns an error message if the bytecode cannot be
+     * decoded.
+     *
+     * If bind_quotes is true, quotes which reference builtin words are
+     * decoded into native quotes which call the builtin words directly.
+     * Such quotes cannot be instrumented by the profiler nor written into
+     * snapshots.
+     */
+    std::optional<std::string> decode(
+      const std::shared_ptr<plorth::runtime>& runtime,
+      bool bind_quotes = true
+    );
+
+    /**
+     * Returns values of the module. Module needs to be decoded first.
+     */
     inline const container_type& values() const
     {
       return m_values;
     }
 
+    inline container_type& values()
+    {
+      return m_values;
+    }
+
+    /**
+     * Returns builtin words referenced by the values of the module, in the
+     * same order as the values. Values which aren't
+     * references to builtin words have null pointer in their place, and
+     * trailing null pointers are omitted. Module needs to be decoded first.
+     */
+    inline const builtin_container_type& builtins() const
+    {
+      return m_builtins;
+    }
+
+    /**
+     * Executes given value of an module in given context. If the value is an
+     * reference to builtin word, it's native quote is called directly,
+     * unless the word might have been shadowed by another word, or by an
+     * property of the prototype of the topmost value of the stack.
+     */
+    static bool exec(
+      const std::shared_ptr<plorth::context>& context,
+      const value_type& value,
+      const std::shared_ptr<const builtin>& builtin
+    );
+
+    /**
+     * Marks builtin word with given index as shadowed, after which
+     * references to it are resolved by name. Called whenever an word with
+     * the same name as an builtin word is decoded, as it might end up in
+     * the dictionary of any context through imports.
+     */
+    static void shadow_builtin(std::uint16_t index);
+
   private:
     DISALLOW_COPY_AND_ASSIGN(module);
 
   private:
     const std::u32string m_name;
-    const container_type m_values;
+    const std::uint64_t m_unit_hash;
+    decoder_type m_decoder;
+    container_type m_values;
+    builtin_container_type m_builtins;
   };
 }
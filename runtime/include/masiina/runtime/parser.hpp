@@ -36,8 +36,39 @@ namespace masiina::runtime::parser
     std::string
   >;
 
+  /**
+   * Parses compilation unit from given file. Path `-` refers to the standard
+   * input.
+   */
   result_type parse_file(
     const std::shared_ptr<plorth::runtime>& runtime,
     const std::string& path
   );
+
+  /**
+   * Parses compilation unit from given bytecode. The bytecode is copied, so
+   * it doesn't have to outlive the returned modules.
+   */
+  result_type parse_memory(
+    const std::shared_ptr<plorth::runtime>& runtime,
+    const unsigned char* data,
+    std::size_t size
+  );
+
+  /**
+   * Parses compilation unit from given bytecode without copying it. Modules
+   * are decoded lazily from the bytecode, so it must remain valid for as
+   * long as the returned modules are in use.
+   */
+  result_type parse_buffer(
+    const std::shared_ptr<plorth::runtime>& runtime,
+    const unsigned char* data,
+    std::size_t size
+  );
+
+  /**
+   * Returns the total number of values which have been decoded from
+   * bytecode, including values nested inside arrays, objects and quotes.
+   */
+  std::size_t decoded_value_count();
 }
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <masiina/runtime/module.hpp>
+
+namespace masiina::runtime
+{
+  /**
+   * Stack of words which an routine is currently executing, maintained by
+   * the profiler. Frames are identified by their index in the profiler.
+   * Calls nested deeper than the maximum depth are counted but not
+   * recorded.
+   */
+  struct call_stack
+  {
+    static constexpr std::size_t max_depth = 128;
+
+    std::uint32_t frames[max_depth];
+    std::atomic<std::size_t> depth;
+
+    explicit call_stack()
+      : depth(0) {}
+
+    inline void push(std::uint32_t frame)
+    {
+      const auto current_depth = depth.load(std::memory_order_relaxed);
+
+      if (current_depth < max_depth)
+      {
+        frames[current_depth] = frame;
+      }
+      depth.store(current_depth + 1, std::memory_order_release);
+    }
+
+    inline void pop()
+    {
+      depth.store(
+        depth.load(std::memory_order_relaxed) - 1,
+        std::memory_order_release
+      );
+    }
+  };
+
+  /**
+   * Sampling profiler which periodically records the word stack of the
+   * routine that is being executed, using an SIGPROF timer. Words are
+   * instrumented when their modules are decoded, so that calls to them
+   * maintain call stacks of the routines. Samples are written in the
+   * collapsed stack format understood by flame graph tools.
+   */
+  class profiler
+  {
+  public:
+    /**
+     * Returns the profiler which is currently sampling, if any.
+     */
+    static profiler* current();
+
+    explicit profiler(std::size_t sample_capacity = 4 * 1024 * 1024);
+    ~profiler();
+
+    /**
+     * Starts sampling with given interval in microseconds. Returns false and
+     * leaves errno set if the timer cannot be started.
+     */
+    bool start(long interval = 1000);
+
+    void stop();
+
+    /**
+     * Replaces word declarations in given values with ones which maintain
+     * call stacks of the routines when the words are called.
+     */
+    void instrument(
+      const std::shared_ptr<plorth::runtime>& runtime,
+      module::container_type& values
+    );
+
+    /**
+     * Sets the call stack which is sampled, when execution switches into an
+     * another routine.
+     */
+    inline void switch_to(struct call_stack* stack)
+    {
+      m_active_stack.store(stack, std::memory_order_release);
+    }
+
+    /**
+     * Writes samples into given file in the collapsed stack format. Returns
+     * false and leaves errno set if the file cannot be written.
+     */
+    bool write(const std::string& path) const;
+
+    /**
+     * Returns the number of samples which didn't fit into the sample buffer.
+     */
+    inline std::size_t dropped_samples() const
+    {
+      return m_dropped_samples;
+    }
+
+  private:
+    static void handle_signal(int signal);
+    void sample();
+    std::shared_ptr<plorth::value> instrument(
+      const std::shared_ptr<plorth::runtime>& runtime,
+      const std::shared_ptr<plorth::value>& value
+    );
+
+    DISALLOW_COPY_AND_ASSIGN(profiler);
+
+  private:
+    std::vector<std::string> m_frame_names;
+    // Samples are stored as their depth, followed by frame indexes from the
+    // outermost to the innermost one. The buffer is allocated before the
+    // sampling is started, as it cannot be grown in signal handler.
+    const std::size_t m_sample_capacity;
+    std::unique_ptr<std::uint32_t[]> m_samples;
+    std::atomic<std::size_t> m_sample_size;
+    std::atomic<std::size_t> m_dropped_samples;
+    std::atomic<struct call_stack*> m_active_stack;
+  };
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <masiina/runtime/routine.hpp>
+
+namespace masiina::runtime
+{
+  /**
+   * Event loop which keeps track of routines waiting for file descriptors
+   * to become ready, so that routines performing I/O can be parked instead
+   * of blocking the thread which is stepping them.
+   *
+   * On platforms without epoll, descriptors are always considered to be
+   * ready and I/O words block the calling thread, and polling merely waits
+   * for the timeout to expire.
+   */
+  class reactor
+  {
+  public:
+    enum class interest
+    {
+      read,
+      write
+    };
+
+    explicit reactor();
+    ~reactor();
+
+    /**
+     * Returns boolean flag indicating whether the reactor is able to wait
+     * for descriptors on this platform.
+     */
+    inline bool is_supported() const
+    {
+      return m_poll_fd >= 0;
+    }
+
+    /**
+     * Returns the number of routines which are waiting for descriptors.
+     */
+    inline std::size_t waiting_count() const
+    {
+      return m_waiting_routines.size();
+    }
+
+    /**
+     * Parks given routine until given file descriptor is ready for given
+     * kind of I/O. Returns false and leaves errno set if the descriptor
+     * cannot be waited for, in which case the routine isn't parked.
+     * Descriptors which cannot be polled, such as regular files, are
+     * considered to be always ready.
+     */
+    bool wait(routine& routine, int fd, interest interest);
+
+    /**
+     * Waits until at least one of the descriptors is ready or given timeout
+     * in milliseconds expires, and returns routines which were waiting for
+     * the ready descriptors. Negative timeout waits indefinitely and zero
+     * timeout doesn't wait at all. The returned routines have to be woken up
+     * by the caller.
+     */
+    std::vector<std::shared_ptr<routine>> poll(int timeout);
+
+    /**
+     * Replaces the underlying event notification descriptors with new ones.
+     * Child processes have to do this after fork(), because otherwise they
+     * would share them with the parent process. Must not be called while
+     * routines are waiting for descriptors.
+     */
+    void reopen();
+
+  private:
+    void open();
+    void close();
+
+    DISALLOW_COPY_AND_ASSIGN(reactor);
+
+  private:
+    int m_poll_fd;
+    std::unordered_map<int, std::shared_ptr<routine>> m_waiting_routines;
+  };
+}
@@ -25,34 +25,176 @@
  */
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
 #include <masiina/macros.hpp>
+#include <masiina/runtime/module.hpp>
 #include <plorth/context.hpp>
 
 namespace masiina::runtime
 {
-  class routine
+  /**
+   * Determines how long an routine is allowed to run on each turn before it
+   * has to give way to other routines. Zero values mean that there is no
+   * limit.
+   */
+  struct quantum
+  {
+    // Maximum number of values executed on each turn.
+    std::size_t values;
+    // Maximum duration of each turn.
+    std::chrono::microseconds duration;
+  };
+
+  class environment;
+  struct call_stack;
+
+  /**
+   * Routine executes values on it's own stack, so that it can be suspended
+   * in the middle of an word, either because it's turn has ended or because
+   * it has been parked while waiting for something to happen.
+   */
+  class routine : public std::enable_shared_from_this<routine>
   {
   public:
+    using id_type = std::uint64_t;
+
     explicit routine(
+      class environment& environment,
+      id_type id,
       const std::shared_ptr<plorth::context>& context,
-      const std::vector<std::shared_ptr<plorth::value>>& values
+      const std::vector<std::shared_ptr<plorth::value>>& values,
+      const module::builtin_container_type& builtins = {}
     );
+    ~routine();
+
+    /**
+     * Returns the routine which is being stepped in the calling thread, or
+     * null pointer if there isn't one.
+     */
+    static routine* current();
+
+    inline class environment& environment() const
+    {
+      return m_environment;
+    }
+
+    inline id_type id() const
+    {
+      return m_id;
+    }
 
     inline const std::shared_ptr<plorth::context>& context() const
     {
       return m_context;
     }
 
+    /**
+     * Returns the error which caused the routine to finish, if any.
+     */
+    inline const std::shared_ptr<plorth::error>& error() const
+    {
+      return m_error;
+    }
+
+    /**
+     * Returns the call stack maintained by the profiler, or null pointer if
+     * the routine hasn't been executed while profiling.
+     */
+    inline struct call_stack* call_stack() const
+    {
+      return m_call_stack.get();
+    }
+
+    /**
+     * Returns quantum specific to this routine, which overrides the default
+     * quantum of the environment, if one has been set.
+     */
+    inline const std::optional<struct quantum>& custom_quantum() const
+    {
+      return m_custom_quantum;
+    }
+
+    inline void custom_quantum(const std::optional<struct quantum>& quantum)
+    {
+      m_custom_quantum = quantum;
+    }
+
     bool is_finished() const;
 
-    bool step();
+    /**
+     * Returns boolean flag indicating whether the routine is parked, e.g.
+     * waiting for an another routine or an channel. Parked routines are not
+     * in the run queue until they are woken up by the environment.
+     */
+    inline bool is_parked() const
+    {
+      return m_parked;
+    }
+
+    /**
+     * Executes values of the routine until the given quantum runs out, the
+     * routine yields, parks or it has finished. Returns false if an error
+     * occurred.
+     */
+    bool step(const struct quantum& quantum);
+
+    /**
+     * Requests the routine to end it's current turn after the value that is
+     * currently being executed.
+     */
+    inline void yield()
+    {
+      m_yield_requested = true;
+    }
+
+    /**
+     * Suspends the routine until it's woken up with environment::wake().
+     * Must be called from the routine itself, with an reference to it
+     * stored somewhere so that it can be woken up later.
+     */
+    void park();
+
+    /**
+     * Parks given routine until this routine has finished.
+     */
+    void wait(routine& waiting);
 
   private:
+    struct coroutine;
+
+    static void run();
+    void suspend();
+    bool is_turn_over();
+
     DISALLOW_COPY_AND_ASSIGN(routine);
 
+    friend class environment;
+
   private:
+    class environment& m_environment;
+    const id_type m_id;
     const std::shared_ptr<plorth::context> m_context;
     const std::vector<std::shared_ptr<plorth::value>> m_values;
+    // Native quotes of builtin words referenced by the values, see
+    // module::builtins().
+    const module::builtin_container_type m_builtins;
     std::size_t m_offset;
+    std::optional<struct quantum> m_custom_quantum;
+    bool m_yield_requested;
+    bool m_parked;
+    std::shared_ptr<plorth::error> m_error;
+    // Execution state of the routine, allocated when the routine is stepped
+    // for the first time and released once it has finished.
+    std::unique_ptr<coroutine> m_coroutine;
+    // Limits of the current turn.
+    struct quantum m_quantum;
+    std::chrono::steady_clock::time_point m_deadline;
+    std::size_t m_executed;
+    std::unique_ptr<struct call_stack> m_call_stack;
+    // Routines which are waiting for this routine to finish.
+    std::vector<std::shared_ptr<routine>> m_waiting_routines;
   };
 }
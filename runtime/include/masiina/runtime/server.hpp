@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <unordered_set>
+
+#include <masiina/runtime/environment.hpp>
+
+namespace masiina::runtime
+{
+  /**
+   * Pre-forking server which executes the main module of an compilation
+   * unit for each connection accepted from an Unix domain socket. The unit
+   * is loaded only once, before the worker processes are forked, so the
+   * workers can start executing jobs right away.
+   *
+   * Client sends the arguments of the job, each terminated with NUL byte,
+   * followed by an empty argument. Rest of the data sent by the client is
+   * used as the standard input of the job. Everything sent back to the
+   * client is framed into records, each consisting of an record type byte,
+   * length of the data as 32-bit little endian integer and the data itself.
+   * Standard output and standard error of the job are sent as they are
+   * being written, in records of their own type. Once the job has finished,
+   * the server sends an status record containing single byte with exit
+   * status of the job (0 on success, 1 if an routine failed with an error)
+   * and closes the connection.
+   *
+   * Each worker executes it's jobs one at a time, in single thread apart
+   * from an thread which forwards output of the job to the client, and is
+   * replaced with an new one after it has executed given number of jobs,
+   * so that state leaking from one job to another, such as cached modules,
+   * doesn't accumulate indefinitely.
+   */
+  class server
+  {
+  public:
+    // Maximum combined size of arguments of an job, in bytes.
+    static constexpr std::size_t max_arguments_size = 64 * 1024;
+
+    /**
+     * Types of records sent to the client.
+     */
+    enum class record_type : unsigned char
+    {
+      output = 1,
+      error = 2,
+      status = 3
+    };
+
+    explicit server(
+      class environment& environment,
+      const std::shared_ptr<module>& main_module,
+      std::size_t worker_count,
+      std::size_t max_jobs
+    );
+
+    /**
+     * Returns boolean flag indicating whether the server can be used on
+     * this platform.
+     */
+    static bool is_supported();
+
+    /**
+     * Starts listening to Unix domain socket in given path, forks the
+     * workers and keeps replacing them as they exit, until the process
+     * receives SIGINT or SIGTERM. Returns an error message if the server
+     * cannot be started.
+     */
+    std::optional<std::string> run(const std::string& path);
+
+  private:
+    bool fork_worker();
+    void work();
+    void serve(int connection);
+    void shutdown();
+
+    DISALLOW_COPY_AND_ASSIGN(server);
+
+  private:
+    class environment& m_environment;
+    const std::shared_ptr<module> m_main_module;
+    const std::size_t m_worker_count;
+    const std::size_t m_max_jobs;
+    std::string m_path;
+    int m_socket;
+    std::unordered_set<long> m_workers;
+  };
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace masiina::runtime
+{
+  /**
+   * Counters collected while the runtime is executing an program. They are
+   * cheap enough to be always maintained, and are printed on exit when
+   * requested.
+   */
+  struct statistics
+  {
+    using duration_type = std::chrono::steady_clock::duration;
+
+    // Number of modules in the compilation unit.
+    std::size_t modules_loaded = 0;
+    // Number of modules which have been imported.
+    std::size_t modules_imported = 0;
+    // Time spent loading the compilation unit and decoding the main module.
+    duration_type load_time = duration_type::zero();
+    std::size_t steps = 0;
+    std::size_t routines_spawned = 0;
+    std::size_t routines_finished = 0;
+    std::size_t peak_live_routines = 0;
+    // Time spent importing each module, including execution of it's top
+    // level values, in the order in which they were imported.
+    std::vector<std::pair<std::u32string, duration_type>> import_times;
+  };
+
+  /**
+   * Prints given statistics, along with number of values decoded from the
+   * bytecode and peak memory usage of the process, into given stream.
+   */
+  void print_statistics(std::ostream& output, const statistics& statistics);
+}
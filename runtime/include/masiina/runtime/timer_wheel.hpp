@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <optional>
+#include <vector>
+
+#include <masiina/runtime/routine.hpp>
+
+namespace masiina::runtime
+{
+  /**
+   * Hierarchical timer wheel which keeps track of routines sleeping until
+   * an deadline. Timers are stored in levels of slots, where each level
+   * covers 64 times longer period than the previous one with 64 times
+   * coarser resolution. Timers are moved into lower levels as their
+   * deadline approaches, so inserting and expiring timers takes constant
+   * time regardless of how many of them there are.
+   */
+  class timer_wheel
+  {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    explicit timer_wheel();
+
+    /**
+     * Returns the number of timers which haven't expired yet.
+     */
+    inline std::size_t size() const
+    {
+      return m_size;
+    }
+
+    /**
+     * Inserts routine which is to be woken up at given deadline.
+     */
+    void add(clock::time_point deadline, const std::shared_ptr<routine>& routine);
+
+    /**
+     * Advances the wheel to given time and returns routines whose timers
+     * have expired. The returned routines have to be woken up by the
+     * caller.
+     */
+    std::vector<std::shared_ptr<routine>> advance(clock::time_point now);
+
+    /**
+     * Returns the earliest deadline of the timers, or nothing if there are
+     * no timers.
+     */
+    std::optional<clock::time_point> next_deadline();
+
+  private:
+    static constexpr std::size_t slot_bits = 6;
+    static constexpr std::size_t slot_count = 1 << slot_bits;
+    static constexpr std::size_t level_count = 4;
+
+    struct timer
+    {
+      std::uint64_t expiry;
+      std::shared_ptr<class routine> routine;
+    };
+
+    using slot_type = std::vector<timer>;
+
+    std::uint64_t to_tick(clock::time_point time) const;
+    std::uint64_t next_tick() const;
+    void insert(timer&& timer);
+    void cascade(std::size_t level);
+
+    DISALLOW_COPY_AND_ASSIGN(timer_wheel);
+
+  private:
+    const clock::time_point m_start;
+    // Tick up to which the wheel has been advanced. Each tick is one
+    // millisecond since creation of the wheel.
+    std::uint64_t m_current_tick;
+    std::array<std::array<slot_type, slot_count>, level_count> m_levels;
+    std::size_t m_size;
+  };
+}
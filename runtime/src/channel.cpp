@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <masiina/runtime/channel.hpp>
+#include <masiina/runtime/environment.hpp>
+
+namespace masiina::runtime
+{
+  channel::channel(class environment& environment, std::size_t capacity)
+    : m_environment(environment)
+    , m_capacity(capacity > 0 ? capacity : 1)
+    , m_closed(false) {}
+
+  bool
+  channel::send(routine& sender, const std::shared_ptr<plorth::value>& value)
+  {
+    for (;;)
+    {
+      if (m_closed)
+      {
+        sender.context()->error(
+          plorth::error::code::value,
+          U"Channel has been closed."
+        );
+
+        return false;
+      }
+      else if (m_buffer.size() < m_capacity)
+      {
+        m_buffer.push_back(value);
+        wake_one(m_waiting_receivers);
+
+        return true;
+      }
+      m_waiting_senders.push_back(sender.shared_from_this());
+      sender.park();
+    }
+  }
+
+  std::shared_ptr<plorth::value>
+  channel::receive(routine& receiver)
+  {
+    for (;;)
+    {
+      if (!m_buffer.empty())
+      {
+        const auto value = std::move(m_buffer.front());
+
+        m_buffer.pop_front();
+        wake_one(m_waiting_senders);
+
+        return value;
+      }
+      else if (m_closed)
+      {
+        return nullptr;
+      }
+      m_waiting_receivers.push_back(receiver.shared_from_this());
+      receiver.park();
+    }
+  }
+
+  void
+  channel::close()
+  {
+    m_closed = true;
+    wake_all(m_waiting_senders);
+    wake_all(m_waiting_receivers);
+  }
+
+  void
+  channel::wake_one(std::deque<std::shared_ptr<routine>>& queue)
+  {
+    if (!queue.empty())
+    {
+      const auto routine = std::move(queue.front());
+
+      queue.pop_front();
+      m_environment.wake(routine);
+    }
+  }
+
+  void
+  channel::wake_all(std::deque<std::shared_ptr<routine>>& queue)
+  {
+    while (!queue.empty())
+    {
+      wake_one(queue);
+    }
+  }
+}
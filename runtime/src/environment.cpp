@@ -23,16 +23,32 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <sstream>
 
 #include <masiina/runtime/environment.hpp>
+#include <masiina/runtime/parser.hpp>
+#include <masiina/runtime/words.hpp>
 #include <peelo/unicode/encoding/utf8.hpp>
 
 namespace masiina::runtime
 {
   environment::environment()
     : m_memory_manager()
-    , m_runtime(plorth::runtime::make(m_memory_manager)) {}
+    , m_runtime(plorth::runtime::make(m_memory_manager))
+    , m_live_routines(0)
+    , m_last_routine_id(0)
+    , m_default_quantum({ 1, std::chrono::microseconds(0) })
+    , m_stack_size(1024 * 1024)
+    , m_bind_quotes(true)
+    , m_profiler(nullptr)
+    , m_steps_since_poll(0)
+    , m_error_output(&std::cerr)
+  {
+    register_words(m_runtime);
+  }
 
   void
   environment::add_imported_module(const std::shared_ptr<module>& module)
@@ -40,79 +56,304 @@ namespace masiina::runtime
     m_imported_modules[module->name()] = module;
   }
 
-  bool
-  environment::is_finished() const
+  std::optional<std::uint64_t>
+  environment::unit_hash() const
+  {
+    if (m_imported_modules.empty())
+    {
+      return std::nullopt;
+    }
+
+    return std::begin(m_imported_modules)->second->unit_hash();
+  }
+
+  std::optional<std::string>
+  environment::load_snapshot(const std::string& path)
   {
-    for (const auto& routine : m_routines)
+    const auto result = parser::parse_file(m_runtime, path);
+    const auto expected_hash = unit_hash();
+
+    if (!result)
     {
-      if (!routine->is_finished())
+      const auto& error = result.error();
+
+      return std::make_optional<std::string>(error ? *error : "Unknown error.");
+    }
+    // Modules of an stale snapshot would take priority over the ones in the
+    // compilation unit, so snapshot of another unit is rejected as a whole.
+    for (const auto& module : *result.value())
+    {
+      if (!expected_hash || module->unit_hash() != *expected_hash)
       {
-        return false;
+        return std::make_optional<std::string>(
+          "Snapshot `" + path + "' was not taken from this compilation unit."
+        );
       }
     }
+    for (const auto& module : *result.value())
+    {
+      m_snapshot_modules[module->name()] = module;
+    }
 
-    return true;
+    return std::nullopt;
+  }
+
+  std::optional<std::string>
+  environment::decode_module(const std::shared_ptr<module>& module)
+  {
+    if (module->is_decoded())
+    {
+      return std::nullopt;
+    }
+    else if (const auto error = module->decode(
+      m_runtime,
+      // Profiler needs compiled quotes for instrumenting words declared
+      // inside of them.
+      m_bind_quotes && !m_profiler
+    ))
+    {
+      return error;
+    }
+    else if (m_profiler)
+    {
+      m_profiler->instrument(m_runtime, module->values());
+    }
+
+    return std::nullopt;
+  }
+
+  std::shared_ptr<routine>
+  environment::spawn(
+    const std::vector<std::shared_ptr<plorth::value>>& values,
+    const std::shared_ptr<plorth::context>& context
+  )
+  {
+    return spawn(values, {}, context);
+  }
+
+  std::shared_ptr<routine>
+  environment::spawn(
+    const std::shared_ptr<module>& module,
+    const std::shared_ptr<plorth::context>& context
+  )
+  {
+    return spawn(module->values(), module->builtins(), context);
+  }
+
+  std::shared_ptr<routine>
+  environment::spawn(
+    const std::vector<std::shared_ptr<plorth::value>>& values,
+    const module::builtin_container_type& builtins,
+    const std::shared_ptr<plorth::context>& context
+  )
+  {
+    const auto routine = std::make_shared<class routine>(
+      *this,
+      ++m_last_routine_id,
+      context ? context : plorth::context::make(m_runtime),
+      values,
+      builtins
+    );
+
+    m_run_queue.push_back(routine);
+    ++m_live_routines;
+
+    ++m_statistics.routines_spawned;
+    m_statistics.peak_live_routines = std::max(
+      m_statistics.peak_live_routines,
+      m_statistics.routines_spawned - m_statistics.routines_finished
+    );
+
+    return routine;
   }
 
   void
-  environment::spawn(const std::vector<std::shared_ptr<plorth::value>>& values)
+  environment::wake(const std::shared_ptr<routine>& routine)
   {
-    m_routines.push_back(std::make_shared<routine>(
-      plorth::context::make(m_runtime),
-      values
-    ));
+    if (!routine->m_parked)
+    {
+      return;
+    }
+    routine->m_parked = false;
+    m_run_queue.push_back(routine);
   }
 
   bool
   environment::step()
   {
+    std::shared_ptr<routine> routine;
     bool error_occurred = false;
 
-    if (m_routine_offset < m_routines.size())
+    if (has_pending_events()
+        && (m_run_queue.empty() || ++m_steps_since_poll >= poll_interval))
     {
-      const auto& routine = m_routines[m_routine_offset];
+      const int timeout = m_run_queue.empty() ? poll_timeout() : 0;
 
-      if (!routine->step())
+      m_steps_since_poll = 0;
+      for (const auto& routine : m_reactor.poll(timeout))
       {
-        const auto& context = routine->context();
-        const auto& error = context->error();
+        wake(routine);
+      }
+      wake_expired_timers();
+    }
 
-        if (error)
-        {
-          const auto& position = error->position();
+    if (m_run_queue.empty())
+    {
+      if (!m_live_routines || has_pending_events())
+      {
+        return false;
+      }
+      report_deadlock();
+      m_live_routines = 0;
 
-          error_occurred = true;
-          std::cerr << "Error: ";
-          if (position && (!position->file.empty() || position->line))
-          {
-            std::cerr
-              << peelo::unicode::encoding::utf8::encode(position->file)
-              << ":"
-              << position->line
-              << ":"
-              << position->column
-              << ":";
-          }
-          std::cerr
-            << error->code()
-            << " - "
-            << peelo::unicode::encoding::utf8::encode(error->message());
-        } else {
-          std::cerr << "Unknown error." << std::endl;
-        }
-        std::cerr << std::endl;
-        context->clear_error();
+      return true;
+    }
+
+    routine = std::move(m_run_queue.front());
+    m_run_queue.pop_front();
+
+    if (!step(routine))
+    {
+      error_occurred = true;
+    }
+
+    if (routine->is_finished())
+    {
+      --m_live_routines;
+    }
+    else if (!routine->is_parked())
+    {
+      m_run_queue.push_back(std::move(routine));
+    }
+
+    return error_occurred;
+  }
+
+  bool
+  environment::step(const std::shared_ptr<routine>& routine)
+  {
+    const auto& quantum = routine->custom_quantum();
+    const bool result = routine->step(quantum ? *quantum : m_default_quantum);
+
+    if (!result)
+    {
+      report_error(routine->context());
+    }
+    ++m_statistics.steps;
+    if (routine->is_finished())
+    {
+      ++m_statistics.routines_finished;
+      for (const auto& waiting : routine->m_waiting_routines)
+      {
+        wake(waiting);
       }
-      if (routine->is_finished())
+      routine->m_waiting_routines.clear();
+    }
+
+    return result;
+  }
+
+  int
+  environment::poll_timeout()
+  {
+    const auto deadline = m_timers.next_deadline();
+
+    if (!deadline)
+    {
+      return -1;
+    }
+
+    const auto now = timer_wheel::clock::now();
+
+    if (*deadline <= now)
+    {
+      return 0;
+    }
+
+    const auto timeout = std::chrono::ceil<std::chrono::milliseconds>(
+      *deadline - now
+    ).count();
+
+    // Deadlines far in the future would not fit into the timeout argument
+    // of poll(), so the reactor is just woken up earlier in that case.
+    return static_cast<int>(std::min<decltype(timeout)>(
+      timeout,
+      std::numeric_limits<int>::max()
+    ));
+  }
+
+  void
+  environment::wake_expired_timers()
+  {
+    if (m_timers.size() > 0)
+    {
+      for (const auto& routine : m_timers.advance(timer_wheel::clock::now()))
       {
-        m_routines.erase(m_routines.begin() + m_routine_offset);
+        wake(routine);
       }
-      ++m_routine_offset;
-    } else {
-      m_routine_offset = 0;
+    }
+  }
+
+  void
+  environment::sleep(routine& routine, std::chrono::milliseconds duration)
+  {
+    m_timers.add(
+      timer_wheel::clock::now() + duration,
+      routine.shared_from_this()
+    );
+    routine.park();
+  }
+
+  std::string
+  environment::format_error(const std::shared_ptr<plorth::error>& error)
+  {
+    std::ostringstream output;
+
+    if (!error)
+    {
+      return "Unknown error.";
     }
 
-    return error_occurred;
+    const auto& position = error->position();
+
+    output << "Error: ";
+    if (position && (!position->file.empty() || position->line))
+    {
+      output
+        << peelo::unicode::encoding::utf8::encode(position->file)
+        << ":"
+        << position->line
+        << ":"
+        << position->column
+        << ":";
+    }
+    output
+      << error->code()
+      << " - "
+      << peelo::unicode::encoding::utf8::encode(error->message());
+
+    return output.str();
+  }
+
+  void
+  environment::report_error(const std::shared_ptr<plorth::context>& context)
+  {
+    if (m_error_output)
+    {
+      *m_error_output << format_error(context->error()) << std::endl;
+    }
+    context->clear_error();
+  }
+
+  void
+  environment::report_deadlock()
+  {
+    if (m_error_output)
+    {
+      *m_error_output
+        << "Error: Deadlock - all routines are waiting for each other."
+        << std::endl;
+    }
   }
 
   std::shared_ptr<plorth::object>
@@ -128,18 +369,44 @@ namespace masiina::runtime
       return cached_module_index->second;
     }
 
+    const auto snapshot_module_index = m_snapshot_modules.find(path);
+
+    if (snapshot_module_index != std::end(m_snapshot_modules))
+    {
+      return import_snapshot_module(context, snapshot_module_index->second);
+    }
+
     const auto imported_module_index = m_imported_modules.find(path);
 
     if (imported_module_index != std::end(m_imported_modules))
     {
+      const auto& imported_module = imported_module_index->second;
+      const auto start = std::chrono::steady_clock::now();
       auto module_context = plorth::context::make(context->runtime());
       std::vector<plorth::object::value_type> result;
       std::shared_ptr<plorth::object> module;
 
+      if (const auto error = decode_module(imported_module))
+      {
+        context->error(
+          plorth::error::code::import,
+          peelo::unicode::encoding::utf8::decode(*error)
+        );
+
+        return nullptr;
+      }
+
+      const auto& values = imported_module->values();
+      const auto& builtins = imported_module->builtins();
+
       module_context->filename(path);
-      for (const auto& value : imported_module_index->second->values())
+      for (std::size_t i = 0; i < values.size(); ++i)
       {
-        if (!plorth::value::exec(module_context, value))
+        if (!masiina::runtime::module::exec(
+          module_context,
+          values[i],
+          i < builtins.size() ? builtins[i] : nullptr
+        ))
         {
           const auto error = module_context->error();
 
@@ -161,6 +428,12 @@ namespace masiina::runtime
       module = context->runtime()->object(result);
       m_module_cache[path] = module;
 
+      ++m_statistics.modules_imported;
+      m_statistics.import_times.emplace_back(
+        path,
+        std::chrono::steady_clock::now() - start
+      );
+
       return module;
     }
 
@@ -168,4 +441,55 @@ namespace masiina::runtime
 
     return nullptr;
   }
+
+  std::shared_ptr<plorth::object>
+  environment::import_snapshot_module(
+    const std::shared_ptr<plorth::context>& context,
+    const std::shared_ptr<module>& snapshot_module
+  )
+  {
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<plorth::object::value_type> result;
+    std::shared_ptr<plorth::object> module;
+
+    if (const auto error = decode_module(snapshot_module))
+    {
+      context->error(
+        plorth::error::code::import,
+        peelo::unicode::encoding::utf8::decode(*error)
+      );
+
+      return nullptr;
+    }
+
+    // Snapshot modules consist only of word declarations, so the module
+    // object can be constructed from them directly.
+    for (const auto& value : snapshot_module->values())
+    {
+      if (!value || value->type() != plorth::value::type::word)
+      {
+        context->error(
+          plorth::error::code::import,
+          U"Snapshot of module `" + snapshot_module->name() + U"' is corrupted."
+        );
+
+        return nullptr;
+      }
+
+      const auto word = std::static_pointer_cast<plorth::word>(value);
+
+      result.push_back({ word->symbol()->id(), word->quote() });
+    }
+
+    module = context->runtime()->object(result);
+    m_module_cache[snapshot_module->name()] = module;
+
+    ++m_statistics.modules_imported;
+    m_statistics.import_times.emplace_back(
+      snapshot_module->name(),
+      std::chrono::steady_clock::now() - start
+    );
+
+    return module;
+  }
 }
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <masiina/runtime/host.hpp>
+
+namespace masiina::runtime
+{
+  host::host()
+    : m_environment() {}
+
+  std::optional<std::string>
+  host::load(const std::string& path)
+  {
+    if (m_main_module)
+    {
+      return std::make_optional<std::string>(
+        "Compilation unit has already been loaded."
+      );
+    }
+
+    return load(parser::parse_file(m_environment.runtime(), path));
+  }
+
+  std::optional<std::string>
+  host::load(const unsigned char* data, std::size_t size, bool copy)
+  {
+    if (m_main_module)
+    {
+      return std::make_optional<std::string>(
+        "Compilation unit has already been loaded."
+      );
+    }
+
+    return load(
+      copy
+        ? parser::parse_memory(m_environment.runtime(), data, size)
+        : parser::parse_buffer(m_environment.runtime(), data, size)
+    );
+  }
+
+  std::optional<std::string>
+  host::load(const parser::result_type& result)
+  {
+    if (!result)
+    {
+      const auto& error = result.error();
+
+      return std::make_optional<std::string>(
+        error ? *error : "Unknown error."
+      );
+    }
+
+    const auto& modules = *result.value();
+
+    if (modules.empty())
+    {
+      return std::make_optional<std::string>(
+        "Compilation unit does not contain any modules."
+      );
+    }
+
+    m_environment.statistics().modules_loaded += modules.size();
+    for (const auto& module : modules)
+    {
+      m_environment.add_imported_module(module);
+    }
+
+    // Main module is decoded right away, so that decoding errors are
+    // reported when the unit is loaded instead of when it's executed.
+    if (const auto error = m_environment.decode_module(modules[0]))
+    {
+      return error;
+    }
+    m_main_module = modules[0];
+
+    return std::nullopt;
+  }
+
+  std::shared_ptr<routine>
+  host::spawn(const std::vector<std::shared_ptr<plorth::value>>& arguments)
+  {
+    std::shared_ptr<plorth::context> context;
+
+    if (!m_main_module)
+    {
+      return nullptr;
+    }
+    context = plorth::context::make(m_environment.runtime());
+    for (const auto& argument : arguments)
+    {
+      context->push(argument);
+    }
+
+    return m_environment.spawn(m_main_module, context);
+  }
+
+  bool
+  host::run(std::size_t budget)
+  {
+    for (std::size_t steps = 0; !budget || steps < budget; ++steps)
+    {
+      if (m_environment.is_finished())
+      {
+        break;
+      }
+      m_environment.step();
+    }
+
+    return m_environment.is_finished();
+  }
+
+  host::result_type
+  host::result(const std::shared_ptr<routine>& routine)
+  {
+    if (const auto& error = routine->error())
+    {
+      return result_type::error(environment::format_error(error));
+    }
+    else if (!routine->is_finished())
+    {
+      return result_type::error("Routine has not finished.");
+    }
+
+    const auto& data = routine->context()->data();
+
+    return result_type::ok(
+      std::vector<std::shared_ptr<plorth::value>>(
+        std::begin(data),
+        std::end(data)
+      )
+    );
+  }
+}
@@ -23,80 +23,437 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <masiina/compression.hpp>
+#include <masiina/runtime/config.hpp>
 #include <masiina/runtime/io.hpp>
 #include <peelo/unicode/encoding/utf8.hpp>
 
+#if defined(HAVE_MMAP)
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#if !defined(BUFSIZ)
+# define BUFSIZ 1024
+#endif
+
 namespace masiina::runtime::io
 {
+  static std::shared_ptr<buffer>
+  read_contents(FILE* input)
+  {
+    unsigned char* data = nullptr;
+    std::size_t size = 0;
+    std::size_t capacity = 0;
+
+    for (;;)
+    {
+      std::size_t read;
+
+      if (capacity - size < BUFSIZ)
+      {
+        const auto new_capacity = capacity > 0 ? capacity * 2 : BUFSIZ * 4;
+        const auto new_data = static_cast<unsigned char*>(
+          std::realloc(static_cast<void*>(data), new_capacity)
+        );
+
+        if (!new_data)
+        {
+          std::free(static_cast<void*>(data));
+          errno = ENOMEM;
+
+          return nullptr;
+        }
+        data = new_data;
+        capacity = new_capacity;
+      }
+      read = std::fread(
+        static_cast<void*>(data + size),
+        1,
+        capacity - size,
+        input
+      );
+      if (read > 0)
+      {
+        size += read;
+      } else {
+        break;
+      }
+    }
+
+    if (std::ferror(input))
+    {
+      std::free(static_cast<void*>(data));
+
+      return nullptr;
+    }
+
+    return std::make_shared<buffer>(data, size, buffer::storage::heap);
+  }
+
+  std::shared_ptr<buffer>
+  buffer::open(const std::string& path)
+  {
+    FILE* input;
+    std::shared_ptr<buffer> result;
+
+#if defined(HAVE_MMAP)
+    // Standard input is duplicated, so that it can be closed just like any
+    // other file once it's contents have been read.
+    const int fd = path == "-"
+      ? ::dup(STDIN_FILENO)
+      : ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+
+    if (fd < 0)
+    {
+      return nullptr;
+    }
+
+    // Only regular files can be memory mapped. Pipes, character devices and
+    // such are read through the buffered fallback below.
+    if (!::fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+      const auto size = static_cast<std::size_t>(st.st_size);
+      void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (data != MAP_FAILED)
+      {
+        ::close(fd);
+
+        return std::make_shared<buffer>(
+          static_cast<const unsigned char*>(data),
+          size,
+          storage::mapped
+        );
+      }
+    }
+
+    if (!(input = ::fdopen(fd, "rb")))
+    {
+      ::close(fd);
+
+      return nullptr;
+    }
+#else
+    if (path == "-")
+    {
+      return read_contents(stdin);
+    }
+    else if (!(input = std::fopen(path.c_str(), "rb")))
+    {
+      return nullptr;
+    }
+#endif
+    result = read_contents(input);
+    std::fclose(input);
+
+    return result;
+  }
+
+  std::shared_ptr<buffer>
+  buffer::copy(const unsigned char* data, std::size_t size)
+  {
+    // Allocate at least one byte so that empty buffers can be told apart
+    // from failed allocations.
+    const auto copy = static_cast<unsigned char*>(
+      std::malloc(size > 0 ? size : 1)
+    );
+
+    if (!copy)
+    {
+      return nullptr;
+    }
+    if (size > 0)
+    {
+      std::memcpy(static_cast<void*>(copy), static_cast<const void*>(data), size);
+    }
+
+    return std::make_shared<buffer>(copy, size, storage::heap);
+  }
+
+  std::shared_ptr<buffer>
+  buffer::decompress(
+    const unsigned char* data,
+    std::size_t size,
+    std::size_t decompressed_size
+  )
+  {
+    unsigned char* output;
+
+    // No byte of compressed data decompresses into more than 255 bytes,
+    // which protects us from allocating huge amounts of memory due to
+    // corrupted size.
+    if (decompressed_size / 255 > size)
+    {
+      return nullptr;
+    }
+
+    if (!(output = static_cast<unsigned char*>(
+      std::malloc(decompressed_size > 0 ? decompressed_size : 1)
+    )))
+    {
+      return nullptr;
+    }
+    if (!compression::decompress(data, size, output, decompressed_size))
+    {
+      std::free(static_cast<void*>(output));
+
+      return nullptr;
+    }
+
+    return std::make_shared<buffer>(output, decompressed_size, storage::heap);
+  }
+
+  std::shared_ptr<buffer>
+  buffer::wrap(const unsigned char* data, std::size_t size)
+  {
+    return std::make_shared<buffer>(data, size, storage::external);
+  }
+
+  buffer::buffer(
+    const unsigned char* data,
+    std::size_t size,
+    enum storage storage
+  )
+    : m_data(data)
+    , m_size(size)
+    , m_storage(storage) {}
+
+  buffer::~buffer()
+  {
+    switch (m_storage)
+    {
+      case storage::heap:
+        std::free(const_cast<unsigned char*>(m_data));
+        break;
+
+      case storage::mapped:
+#if defined(HAVE_MMAP)
+        ::munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+        break;
+
+      case storage::external:
+        break;
+    }
+  }
+
   bool
-  read_uint16(FILE* input, std::uint16_t& number)
+  read_byte(cursor& input, unsigned char& byte)
   {
-    char buffer[2];
-    const auto read = std::fread(static_cast<void*>(buffer), 2, 1, input);
+    if (input.current >= input.end)
+    {
+      return false;
+    }
+    byte = *input.current++;
 
-    if (read != 1)
+    return true;
+  }
+
+  bool
+  read_uint16(cursor& input, std::uint16_t& number)
+  {
+    if (input.end - input.current < 2)
     {
       return false;
     }
 
     number = static_cast<std::uint16_t>(
-      (buffer[0] << 0)
-      + (buffer[1] << 8)
+      (static_cast<std::uint16_t>(input.current[0]) << 0)
+      | (static_cast<std::uint16_t>(input.current[1]) << 8)
     );
+    input.current += 2;
 
     return true;
   }
 
   bool
-  read_uint32(FILE* input, std::uint32_t& number)
+  read_uint32(cursor& input, std::uint32_t& number)
   {
-    char buffer[4];
-    const auto read = std::fread(static_cast<void*>(buffer), 4, 1, input);
-
-    if (read != 1)
+    if (input.end - input.current < 4)
     {
       return false;
     }
 
-    number = static_cast<std::uint32_t>(
-      (buffer[0] << 0)
-      + (buffer[1] << 8)
-      + (buffer[2] << 16)
-      + (buffer[3] << 24)
-    );
+    number = (static_cast<std::uint32_t>(input.current[0]) << 0)
+      | (static_cast<std::uint32_t>(input.current[1]) << 8)
+      | (static_cast<std::uint32_t>(input.current[2]) << 16)
+      | (static_cast<std::uint32_t>(input.current[3]) << 24);
+    input.current += 4;
 
     return true;
   }
 
   bool
-  read_string(FILE* input, std::u32string& str)
+  read_uint64(cursor& input, std::uint64_t& number)
   {
-    std::uint32_t length;
+    std::uint32_t low;
+    std::uint32_t high;
 
-    if (!read_uint32(input, length))
+    if (!read_uint32(input, low) || !read_uint32(input, high))
     {
       return false;
     }
+    number = (static_cast<std::uint64_t>(high) << 32) | low;
 
-    if (length > 0)
+    return true;
+  }
+
+  bool
+  read_varint(cursor& input, std::uint32_t& number)
+  {
+    const unsigned char* current = input.current;
+    std::uint32_t result;
+
+    // Most of the encoded numbers fit into a single byte.
+    if (current < input.end && !(*current & 0x80))
     {
-      char buffer[length];
-      const auto read = std::fread(
-        static_cast<void*>(buffer),
-        length,
-        1,
-        input
-      );
+      number = *current;
+      input.current = current + 1;
 
-      if (read != 1)
+      return true;
+    }
+
+    result = 0;
+    for (int shift = 0; shift < 32; shift += 7)
+    {
+      if (current >= input.end)
       {
         return false;
       }
-      str.assign(peelo::unicode::encoding::utf8::decode(buffer, length));
+      result |= static_cast<std::uint32_t>(*current & 0x7f) << shift;
+      if (!(*current++ & 0x80))
+      {
+        number = result;
+        input.current = current;
+
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool
+  read_svarint(cursor& input, std::int32_t& number)
+  {
+    std::uint32_t encoded;
+
+    if (!read_varint(input, encoded))
+    {
+      return false;
+    }
+    number = static_cast<std::int32_t>(encoded >> 1)
+      ^ -static_cast<std::int32_t>(encoded & 1);
+
+    return true;
+  }
+
+  bool
+  read_string(cursor& input, std::u32string& str)
+  {
+    std::uint32_t length;
+
+    if (!read_varint(input, length))
+    {
+      return false;
+    }
+
+    if (static_cast<std::size_t>(input.end - input.current) < length)
+    {
+      return false;
+    }
+
+    if (length > 0)
+    {
+      str.assign(peelo::unicode::encoding::utf8::decode(
+        reinterpret_cast<const char*>(input.current),
+        length
+      ));
+      input.current += length;
     } else {
       str.clear();
     }
 
     return true;
   }
+
+  void
+  write_uint16(std::vector<unsigned char>& output, std::uint16_t number)
+  {
+    output.push_back(static_cast<unsigned char>((number >> 0) & 0xff));
+    output.push_back(static_cast<unsigned char>((number >> 8) & 0xff));
+  }
+
+  void
+  write_uint32(std::vector<unsigned char>& output, std::uint32_t number)
+  {
+    output.push_back(static_cast<unsigned char>((number >> 0) & 0xff));
+    output.push_back(static_cast<unsigned char>((number >> 8) & 0xff));
+    output.push_back(static_cast<unsigned char>((number >> 16) & 0xff));
+    output.push_back(static_cast<unsigned char>((number >> 24) & 0xff));
+  }
+
+  void
+  write_uint64(std::vector<unsigned char>& output, std::uint64_t number)
+  {
+    write_uint32(output, static_cast<std::uint32_t>(number & 0xffffffff));
+    write_uint32(output, static_cast<std::uint32_t>(number >> 32));
+  }
+
+  void
+  write_varint(std::vector<unsigned char>& output, std::uint32_t number)
+  {
+    while (number >= 0x80)
+    {
+      output.push_back(static_cast<unsigned char>((number & 0x7f) | 0x80));
+      number >>= 7;
+    }
+    output.push_back(static_cast<unsigned char>(number));
+  }
+
+  void
+  write_svarint(std::vector<unsigned char>& output, std::int32_t number)
+  {
+    // Zigzag encoding maps small negative numbers to small positive ones.
+    write_varint(
+      output,
+      (static_cast<std::uint32_t>(number) << 1)
+        ^ static_cast<std::uint32_t>(number >> 31)
+    );
+  }
+
+  void
+  write_string(std::vector<unsigned char>& output, const std::u32string& str)
+  {
+    const auto encoded_str = peelo::unicode::encoding::utf8::encode(str);
+
+    write_varint(output, static_cast<std::uint32_t>(encoded_str.length()));
+    for (const auto& c : encoded_str)
+    {
+      output.push_back(static_cast<unsigned char>(c));
+    }
+  }
+
+  std::uint64_t
+  hash(const unsigned char* data, std::size_t size)
+  {
+    std::uint64_t result = 0xcbf29ce484222325ULL;
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      result ^= data[i];
+      result *= 0x100000001b3ULL;
+    }
+
+    return result;
+  }
 }
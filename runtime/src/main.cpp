@@ -23,13 +23,18 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <thread>
 
 #include <masiina/runtime/config.hpp>
 #include <masiina/runtime/environment.hpp>
 #include <masiina/runtime/parser.hpp>
+#include <masiina/runtime/profiler.hpp>
+#include <masiina/runtime/server.hpp>
+#include <masiina/runtime/snapshot.hpp>
 #include <masiina/version.hpp>
 #include <peelo/unicode/encoding/utf8.hpp>
 #include <plorth/runtime.hpp>
@@ -48,6 +53,16 @@
 static std::string input_path;
 static std::vector<std::u32string> arguments;
 static bool use_fork = false;
+static std::optional<std::size_t> quantum_values;
+static std::optional<std::size_t> quantum_duration;
+static std::optional<std::size_t> stack_size;
+static std::string profile_path;
+static bool print_stats = false;
+static std::string snapshot_path;
+static std::string save_snapshot_path;
+static std::string serve_path;
+static std::size_t serve_workers = 0;
+static std::size_t serve_max_jobs = 1000;
 
 static void
 print_usage(const char* executable)
@@ -59,8 +74,86 @@ print_usage(const char* executable)
     << " [switches] <filename> [arguments...]"
     << std::endl
     << "  -f        Fork to background before executing program." << std::endl
+    << "  -q <n>    Execute up to <n> values on each turn of an routine."
+    << std::endl
+    << "            Zero means no limit. Default is 1." << std::endl
+    << "  -t <usec> Limit duration of each turn of an routine to <usec>"
+    << std::endl
+    << "            microseconds. Zero means no limit, which is the default."
+    << std::endl
+    << "  -s <kb>   Allocate <kb> kilobytes of stack for each routine. Deeply"
+    << std::endl
+    << "            recursive programs need more than the default of 1024."
+    << std::endl
+    << "  --profile=<file>" << std::endl
+    << "            Sample words being executed and write the samples into"
+    << std::endl
+    << "            <file> in collapsed stack format on exit." << std::endl
+    << "  --snapshot=<file>" << std::endl
+    << "            Restore imported modules from snapshot <file> instead of"
+    << std::endl
+    << "            executing them." << std::endl
+    << "  --save-snapshot=<file>" << std::endl
+    << "            Write modules imported by the program into snapshot"
+    << std::endl
+    << "            <file> on exit. Snapshot has to be written again whenever"
+    << std::endl
+    << "            the program is recompiled." << std::endl
+    << "  --serve=<socket>" << std::endl
+    << "            Load the program once and execute it for each connection"
+    << std::endl
+    << "            accepted from Unix domain socket <socket>, in pre-forked"
+    << std::endl
+    << "            worker processes." << std::endl
+    << "  --workers=<n>" << std::endl
+    << "            Number of worker processes in server mode. Zero uses one"
+    << std::endl
+    << "            process for each processor core, which is the default."
+    << std::endl
+    << "  --max-jobs=<n>" << std::endl
+    << "            Replace worker processes after they have executed <n>"
+    << std::endl
+    << "            jobs. Zero means no limit. Default is 1000." << std::endl
+    << "  --stats   Print execution statistics on exit." << std::endl
     << "  --version Print the version." << std::endl
-    << "  --help    Display this message." << std::endl;
+    << "  --help    Display this message." << std::endl
+    << std::endl
+    << "Compilation unit is read from standard input if <filename> is `-'."
+    << std::endl;
+}
+
+static std::size_t
+parse_number(const char* executable, const std::string& option, const char* value)
+{
+  char* end;
+  const auto number = std::strtoul(value, &end, 10);
+
+  if (!*value || *end)
+  {
+    std::cerr
+      << "Invalid argument for the "
+      << option
+      << " option: "
+      << value
+      << std::endl;
+    print_usage(executable);
+    std::exit(EX_USAGE);
+  }
+
+  return static_cast<std::size_t>(number);
+}
+
+static std::size_t
+parse_number_argument(int argc, char** argv, int& offset, char option)
+{
+  if (offset >= argc)
+  {
+    std::cerr << "Argument expected for the -" << option << " option." << std::endl;
+    print_usage(argv[0]);
+    std::exit(EX_USAGE);
+  }
+
+  return parse_number(argv[0], std::string("-") + option, argv[offset++]);
 }
 
 static void
@@ -86,6 +179,11 @@ scan_arguments(int argc, char** argv)
     }
     else if (!arg[1])
     {
+      // Compilation unit is read from the standard input.
+      if (input_path.empty())
+      {
+        input_path = arg;
+      }
       break;
     }
     else if (arg[1] == '-')
@@ -95,6 +193,41 @@ scan_arguments(int argc, char** argv)
         print_usage(argv[0]);
         std::exit(EXIT_SUCCESS);
       }
+      else if (!std::strncmp(arg, "--profile=", 10) && arg[10])
+      {
+        profile_path = arg + 10;
+        continue;
+      }
+      else if (!std::strncmp(arg, "--snapshot=", 11) && arg[11])
+      {
+        snapshot_path = arg + 11;
+        continue;
+      }
+      else if (!std::strncmp(arg, "--save-snapshot=", 16) && arg[16])
+      {
+        save_snapshot_path = arg + 16;
+        continue;
+      }
+      else if (!std::strncmp(arg, "--serve=", 8) && arg[8])
+      {
+        serve_path = arg + 8;
+        continue;
+      }
+      else if (!std::strncmp(arg, "--workers=", 10))
+      {
+        serve_workers = parse_number(argv[0], "--workers", arg + 10);
+        continue;
+      }
+      else if (!std::strncmp(arg, "--max-jobs=", 11))
+      {
+        serve_max_jobs = parse_number(argv[0], "--max-jobs", arg + 11);
+        continue;
+      }
+      else if (!std::strcmp(arg, "--stats"))
+      {
+        print_stats = true;
+        continue;
+      }
       else if (!std::strcmp(arg, "--version"))
       {
         std::cout
@@ -120,6 +253,25 @@ scan_arguments(int argc, char** argv)
           use_fork = true;
           break;
 
+        case 'q':
+          quantum_values = parse_number_argument(argc, argv, offset, 'q');
+          break;
+
+        case 't':
+          quantum_duration = parse_number_argument(argc, argv, offset, 't');
+          break;
+
+        case 's':
+          stack_size = parse_number_argument(argc, argv, offset, 's');
+          if (*stack_size < 64)
+          {
+            std::cerr
+              << "Stack size must be at least 64 kilobytes."
+              << std::endl;
+            std::exit(EX_USAGE);
+          }
+          break;
+
         case 'h':
           print_usage(argv[0]);
           std::exit(EXIT_SUCCESS);
@@ -145,6 +297,7 @@ main(int argc, char** argv)
   masiina::runtime::environment env;
   std::vector<std::shared_ptr<masiina::runtime::module>> modules;
   std::shared_ptr<masiina::runtime::module> main_module;
+  std::unique_ptr<masiina::runtime::profiler> profiler;
   bool error_occurred = false;
 
   scan_arguments(argc, argv);
@@ -157,6 +310,47 @@ main(int argc, char** argv)
 
   env.runtime()->arguments() = arguments;
 
+  if (!profile_path.empty())
+  {
+    profiler = std::make_unique<masiina::runtime::profiler>();
+    if (!profiler->start())
+    {
+      std::cerr
+        << "Unable to start profiler: "
+        << std::strerror(errno)
+        << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    env.profiler(profiler.get());
+  }
+
+  if (quantum_values || quantum_duration)
+  {
+    auto quantum = env.default_quantum();
+
+    if (quantum_values)
+    {
+      quantum.values = *quantum_values;
+    }
+    if (quantum_duration)
+    {
+      quantum.duration = std::chrono::microseconds(*quantum_duration);
+    }
+    env.default_quantum(quantum);
+  }
+
+  if (stack_size)
+  {
+    env.stack_size(*stack_size * 1024);
+  }
+
+  // Native quotes cannot be written into snapshots.
+  if (!save_snapshot_path.empty())
+  {
+    env.bind_quotes(false);
+  }
+
+  const auto load_start = std::chrono::steady_clock::now();
   const auto import_result = masiina::runtime::parser::parse_file(
     env.runtime(),
     input_path
@@ -166,6 +360,7 @@ main(int argc, char** argv)
   {
     const auto& modules = import_result.value();
 
+    env.statistics().modules_loaded = modules->size();
     if (modules->size() > 0)
     {
       main_module = (*modules)[0];
@@ -186,10 +381,28 @@ main(int argc, char** argv)
     std::exit(EXIT_FAILURE);
   }
 
+  if (!snapshot_path.empty())
+  {
+    if (const auto error = env.load_snapshot(snapshot_path))
+    {
+      std::cerr << *error << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
   if (main_module)
   {
-    env.spawn(main_module->values());
+    if (const auto error = env.decode_module(main_module))
+    {
+      std::cerr << *error << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    if (serve_path.empty())
+    {
+      env.spawn(main_module);
+    }
   }
+  env.statistics().load_time = std::chrono::steady_clock::now() - load_start;
 
   if (use_fork)
   {
@@ -198,17 +411,83 @@ main(int argc, char** argv)
     {
       std::exit(EXIT_SUCCESS);
     }
+    // Interval timers are not inherited by the child process.
+    if (profiler)
+    {
+      profiler->start();
+    }
 #else
     std::cerr << "Forking to background is not supported on this platform." << std::endl;
 #endif
   }
 
-  while (!env.is_finished())
+  if (!serve_path.empty())
   {
-    if (!env.step())
+    if (!main_module)
     {
+      std::cerr << "Compilation unit does not contain any modules." << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+
+    masiina::runtime::server server(
+      env,
+      main_module,
+      serve_workers ? serve_workers : std::thread::hardware_concurrency(),
+      serve_max_jobs
+    );
+
+    if (const auto error = server.run(serve_path))
+    {
+      std::cerr << *error << std::endl;
+      error_occurred = true;
+    }
+  } else {
+    while (!env.is_finished())
+    {
+      if (env.step())
+      {
+        error_occurred = true;
+      }
+    }
+  }
+
+  if (!save_snapshot_path.empty() && !error_occurred)
+  {
+    if (const auto error = masiina::runtime::snapshot::write(
+      env,
+      save_snapshot_path
+    ))
+    {
+      std::cerr << *error << std::endl;
+      error_occurred = true;
+    }
+  }
+
+  if (print_stats)
+  {
+    masiina::runtime::print_statistics(std::cerr, env.statistics());
+  }
+
+  if (profiler)
+  {
+    profiler->stop();
+    if (!profiler->write(profile_path))
+    {
+      std::cerr
+        << "Unable to write profile to `"
+        << profile_path
+        << "': "
+        << std::strerror(errno)
+        << std::endl;
       error_occurred = true;
     }
+    else if (profiler->dropped_samples() > 0)
+    {
+      std::cerr
+        << profiler->dropped_samples()
+        << " samples did not fit into the sample buffer."
+        << std::endl;
+    }
   }
 
   return error_occurred ? EXIT_FAILURE : EXIT_SUCCESS;
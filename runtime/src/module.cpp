@@ -23,11 +23,90 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <atomic>
+
+#include <masiina/builtins.hpp>
 #include <masiina/runtime/module.hpp>
 
 namespace masiina::runtime
 {
+  // Builtin words for which an word with the same name has been decoded.
+  // Shared by all runtimes, as an module decoded by one of them is still
+  // shadowing the builtin words in the others at worst.
+  static std::atomic<bool> shadowed_builtins[builtins::count];
+
   module::module(const std::u32string& name, const container_type& values)
     : m_name(name)
+    , m_unit_hash(0)
     , m_values(values) {}
+
+  module::module(
+    const std::u32string& name,
+    const decoder_type& decoder,
+    std::uint64_t unit_hash
+  )
+    : m_name(name)
+    , m_unit_hash(unit_hash)
+    , m_decoder(decoder) {}
+
+  std::optional<std::string>
+  module::decode(
+    const std::shared_ptr<plorth::runtime>& runtime,
+    bool bind_quotes
+  )
+  {
+    container_type values;
+    builtin_container_type builtins;
+
+    if (!m_decoder)
+    {
+      return std::nullopt;
+    }
+
+    if (const auto error = m_decoder(runtime, bind_quotes, values, builtins))
+    {
+      return error;
+    }
+    m_values = std::move(values);
+    m_builtins = std::move(builtins);
+    m_decoder = nullptr;
+
+    return std::nullopt;
+  }
+
+  bool
+  module::exec(
+    const std::shared_ptr<plorth::context>& context,
+    const value_type& value,
+    const std::shared_ptr<const builtin>& builtin
+  )
+  {
+    if (builtin
+        && !shadowed_builtins[builtin->index].load(std::memory_order_relaxed))
+    {
+      const auto& data = context->data();
+
+      // Plorth looks up words from the prototype of the topmost value of
+      // the stack before the dictionaries. Prototypes of the builtin types
+      // don't define any of the builtin words, but prototypes of objects
+      // are up to the program.
+      if (data.empty()
+          || !data.back()
+          || data.back()->type() != plorth::value::type::object)
+      {
+        return builtin->quote->call(context);
+      }
+    }
+
+    return plorth::value::exec(context, value);
+  }
+
+  void
+  module::shadow_builtin(std::uint16_t index)
+  {
+    if (index < builtins::count)
+    {
+      shadowed_builtins[index].store(true, std::memory_order_relaxed);
+    }
+  }
 }
@@ -23,9 +23,12 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <atomic>
 #include <cerrno>
 #include <cstring>
 
+#include <masiina/builtins.hpp>
+#include <masiina/flags.hpp>
 #include <masiina/opcode.hpp>
 #include <masiina/runtime/io.hpp>
 #include <masiina/runtime/parser.hpp>
@@ -33,35 +36,178 @@
 
 namespace masiina::runtime::parser
 {
-  using symbol_map = std::unordered_map<std::uint32_t, std::u32string>;
+  /**
+   * Entry in the symbol table of an compilation unit. String value of the
+   * entry is created when it's referenced for the first time, after which
+   * it's shared by all references to the same constant.
+   */
+  struct symbol_entry
+  {
+    std::u32string id;
+    mutable std::shared_ptr<plorth::string> string;
+  };
+
+  // Symbol table is indexed with dense indexes from 0 to N - 1.
+  using symbol_map = std::vector<symbol_entry>;
+
+  /**
+   * Source code positions of the instructions of an module, which are
+   * decoded from the debug info of the module along with the instructions.
+   * Instructions are numbered in the order their opcodes appear in the
+   * bytecode, and each entry of the debug info begins with the number of
+   * instructions between it and the previous instruction with a position.
+   * Filename and line number are encoded relative to the previous entry.
+   *
+   * The table is not kept around for resolving positions on demand. Plorth
+   * symbols take their position when they are constructed, and errors
+   * raised by Plorth copy the position of the symbol which raised them, so
+   * environment::format_error() and the profiler have nothing to resolve
+   * positions from but the symbols. Separate debug section therefore only
+   * makes compilation units smaller on disk, or leaves positions out
+   * entirely when stripped; an imported module takes as much memory as it
+   * did when positions followed the instructions.
+   */
+  class position_table
+  {
+  public:
+    explicit position_table(const io::cursor& input, const symbol_map& symbol_map)
+      : m_input(input)
+      , m_symbol_map(symbol_map)
+      , m_instruction_count(0)
+      , m_next_instruction(0)
+      , m_file(nullptr)
+      , m_line(0) {}
+
+    /**
+     * Must be called whenever opcode of an instruction has been read.
+     */
+    inline void instruction()
+    {
+      ++m_instruction_count;
+    }
+
+    /**
+     * Looks up position of the instruction whose opcode was read last.
+     * Returns false if the debug info is malformed.
+     */
+    bool
+    lookup(std::optional<plorth::parser::position>& position)
+    {
+      const auto instruction = m_instruction_count - 1;
+      std::uint32_t distance;
+      std::int32_t line_difference;
+      std::uint32_t column;
+
+      if (m_input.current >= m_input.end)
+      {
+        position.reset();
+
+        return true;
+      }
+
+      // Peek at the distance, as the next entry might belong to some later
+      // instruction.
+      {
+        io::cursor input = m_input;
+
+        if (!io::read_varint(input, distance))
+        {
+          return false;
+        }
+        if (m_next_instruction + (distance >> 1) != instruction)
+        {
+          position.reset();
 
-  static bool check_magic_number(FILE*);
-  static std::optional<std::string> check_version_number(FILE*);
-  static bool parse_symbol_map(FILE*, symbol_map&);
+          return m_next_instruction + (distance >> 1) > instruction;
+        }
+        m_input = input;
+      }
+
+      if (distance & 1)
+      {
+        std::uint32_t filename_index;
+
+        if (!io::read_varint(m_input, filename_index)
+            || filename_index >= m_symbol_map.size())
+        {
+          return false;
+        }
+        m_file = &m_symbol_map[filename_index].id;
+      }
+
+      if (!m_file
+          || !io::read_svarint(m_input, line_difference)
+          || !io::read_varint(m_input, column))
+      {
+        return false;
+      }
+      m_line += line_difference;
+      position = plorth::parser::position{
+        *m_file,
+        m_line,
+        static_cast<int>(column)
+      };
+      m_next_instruction = instruction + 1;
+
+      return true;
+    }
+
+  private:
+    io::cursor m_input;
+    const symbol_map& m_symbol_map;
+    std::uint32_t m_instruction_count;
+    std::uint32_t m_next_instruction;
+    const std::u32string* m_file;
+    int m_line;
+  };
+
+  // Name index, offset and length of an module, each 32 bits, followed by
+  // offset and length of it's debug info if the unit has one.
+  static const std::size_t directory_entry_size = 12;
+  static const std::size_t debug_directory_entry_size = 20;
+
+  static std::atomic<std::size_t> decoded_values(0);
+
+  static bool check_magic_number(io::cursor&);
+  static std::optional<std::string> check_version_number(io::cursor&);
+  static bool parse_symbol_map(io::cursor&, symbol_map&);
   static std::shared_ptr<plorth::value> parse_instruction(
-    FILE*,
+    io::cursor&,
     const std::shared_ptr<plorth::runtime>&,
-    const symbol_map&
+    const symbol_map&,
+    position_table&,
+    const module::builtin_container_type*,
+    std::optional<std::uint16_t>* = nullptr
+  );
+  static std::shared_ptr<const module::builtin_container_type> bind_builtins(
+    const std::shared_ptr<plorth::runtime>&
   );
   static std::optional<std::string> parse_module(
-    FILE*,
-    const std::shared_ptr<plorth::runtime>&,
-    const symbol_map&,
+    io::cursor&,
+    const std::shared_ptr<const io::buffer>&,
+    const std::shared_ptr<const symbol_map>&,
+    const std::shared_ptr<const module::builtin_container_type>&,
+    const unsigned char*,
+    std::size_t,
+    unsigned char,
+    std::uint64_t,
     std::vector<std::shared_ptr<module>>&
   );
 
+  static result_type parse_unit(
+    const std::shared_ptr<plorth::runtime>&,
+    const std::shared_ptr<const io::buffer>&
+  );
+
   result_type
   parse_file(
     const std::shared_ptr<plorth::runtime>& runtime,
     const std::string& path
   )
   {
-    FILE* input = std::fopen(path.c_str(), "rb");
-    symbol_map symbol_map;
-    std::uint32_t module_count;
-    std::vector<std::shared_ptr<module>> modules;
+    const auto buffer = io::buffer::open(path);
 
-    if (!input)
+    if (!buffer)
     {
       return result_type::error(
         "Unable to open file `"
@@ -71,86 +217,199 @@ namespace masiina::runtime::parser
       );
     }
 
-    if (!check_magic_number(input))
+    return parse_unit(runtime, buffer);
+  }
+
+  result_type
+  parse_memory(
+    const std::shared_ptr<plorth::runtime>& runtime,
+    const unsigned char* data,
+    std::size_t size
+  )
+  {
+    const auto buffer = io::buffer::copy(data, size);
+
+    if (!buffer)
     {
-      std::fclose(input);
+      return result_type::error("Unable to allocate memory for bytecode.");
+    }
+
+    return parse_unit(runtime, buffer);
+  }
+
+  result_type
+  parse_buffer(
+    const std::shared_ptr<plorth::runtime>& runtime,
+    const unsigned char* data,
+    std::size_t size
+  )
+  {
+    return parse_unit(runtime, io::buffer::wrap(data, size));
+  }
+
+  std::size_t
+  decoded_value_count()
+  {
+    return decoded_values.load(std::memory_order_relaxed);
+  }
+
+  static result_type
+  parse_unit(
+    const std::shared_ptr<plorth::runtime>& runtime,
+    const std::shared_ptr<const io::buffer>& buffer
+  )
+  {
+    io::cursor input;
+    const auto symbol_map = std::make_shared<parser::symbol_map>();
+    const auto builtins = bind_builtins(runtime);
+    std::uint32_t module_count;
+    unsigned char flags;
+    std::uint64_t unit_hash = 0;
+    std::size_t entry_size;
+    const unsigned char* directory;
+    const unsigned char* section;
+    std::size_t section_size;
+    std::vector<std::shared_ptr<module>> modules;
+
+    input.current = buffer->data();
+    input.end = buffer->data() + buffer->size();
 
+    if (!check_magic_number(input))
+    {
       return result_type::error("Magic number mismatch.");
     }
 
     if (const auto error = check_version_number(input))
     {
-      std::fclose(input);
-
       return result_type::error(*error);
     }
 
-    if (!parse_symbol_map(input, symbol_map))
+    if (!io::read_byte(input, flags)
+        || (flags & ~(flags::debug_info | flags::compressed | flags::snapshot)))
     {
-      std::fclose(input);
+      return result_type::error("Unsupported flags.");
+    }
 
+    if ((flags & flags::snapshot) && !io::read_uint64(input, unit_hash))
+    {
+      return result_type::error("Unable to determine hash of snapshot.");
+    }
+
+    entry_size = flags & flags::debug_info
+      ? debug_directory_entry_size
+      : directory_entry_size;
+    directory = input.current;
+
+    if (!parse_symbol_map(input, *symbol_map))
+    {
       return result_type::error("Unable to process symbol table.");
     }
 
     if (!io::read_uint32(input, module_count))
     {
-      std::fclose(input);
-
       return result_type::error("Unable to determine module count.");
     }
 
+    // Module directory is followed by the module section, into which offsets
+    // of the directory entries point to. Debug info of the modules is in the
+    // same section, after all of the modules.
+    if (static_cast<std::size_t>(input.end - input.current)
+        / entry_size < module_count)
+    {
+      return result_type::error("Unable to process module directory.");
+    }
+    section = input.current + module_count * entry_size;
+    section_size = static_cast<std::size_t>(input.end - section);
+
+    // Compilation unit is identified by it's symbol table and module
+    // directory, which are read in any case, so that the modules themselves
+    // don't have to be touched. Snapshots are identified by the unit from
+    // which they were taken instead.
+    if (!(flags & flags::snapshot))
+    {
+      unit_hash = io::hash(
+        directory,
+        static_cast<std::size_t>(section - directory)
+      );
+    }
+
     for (std::uint32_t i = 0; i < module_count; ++i)
     {
-      const auto error = parse_module(input, runtime, symbol_map, modules);
+      const auto error = parse_module(
+        input,
+        buffer,
+        symbol_map,
+        builtins,
+        section,
+        section_size,
+        flags,
+        unit_hash,
+        modules
+      );
 
       if (error)
       {
-        std::fclose(input);
-
         return result_type::error(*error);
       }
     }
 
-    std::fclose(input);
-
     return result_type::ok(modules);
   }
 
   static bool
-  check_magic_number(FILE* input)
+  check_magic_number(io::cursor& input)
   {
-    char buffer[3];
-    const auto read = std::fread(static_cast<void*>(buffer), 3, 1, input);
+    if (input.end - input.current < 3)
+    {
+      return false;
+    }
 
-    if (read != 1)
+    if (input.current[0] != 'R'
+        || input.current[1] != 'j'
+        || input.current[2] != 'L')
     {
       return false;
     }
+    input.current += 3;
 
-    return buffer[0] == 'R' && buffer[1] == 'j' && buffer[2] == 'L';
+    return true;
   }
 
   static std::optional<std::string>
-  check_version_number(FILE* input)
+  check_version_number(io::cursor& input)
   {
-    char buffer[3];
-    const auto read = std::fread(static_cast<void*>(buffer), 3, 1, input);
-
-    if (read != 1)
+    if (input.end - input.current < 3)
     {
       return std::make_optional<std::string>("Unable to parse version number.");
     }
 
-    if (buffer[2] > MASIINA_VERSION_MAJOR)
+    const auto minor = input.current[1];
+    const auto major = input.current[2];
+
+    // Format of the compilation unit changes between minor versions as
+    // well, so newer minor version cannot be decoded either.
+    if (major > MASIINA_VERSION_MAJOR
+        || (major == MASIINA_VERSION_MAJOR && minor > MASIINA_VERSION_MINOR))
     {
       return std::make_optional<std::string>("Incompatible version number.");
     }
 
+    if (major < MASIINA_MINIMUM_VERSION_MAJOR
+        || (major == MASIINA_MINIMUM_VERSION_MAJOR
+            && minor < MASIINA_MINIMUM_VERSION_MINOR))
+    {
+      return std::make_optional<std::string>(
+        "Compilation unit has been compiled with an older version of the "
+        "compiler. Please recompile it."
+      );
+    }
+    input.current += 3;
+
     return std::nullopt;
   }
 
   static bool
-  parse_symbol_map(FILE* input, symbol_map& map)
+  parse_symbol_map(io::cursor& input, symbol_map& map)
   {
     std::uint32_t size;
 
@@ -158,15 +417,19 @@ namespace masiina::runtime::parser
     {
       return false;
     }
-    for (std::uint32_t i = 0; i < size; ++i)
+    // Each entry takes at least one byte, which protects us from reserving
+    // huge amounts of memory due to corrupted symbol count.
+    if (static_cast<std::size_t>(input.end - input.current) < size)
     {
-      std::u32string str;
-
-      if (!io::read_string(input, str))
+      return false;
+    }
+    map.resize(size);
+    for (auto& entry : map)
+    {
+      if (!io::read_string(input, entry.id))
       {
         return false;
       }
-      map[i] = str;
     }
 
     return true;
@@ -174,15 +437,17 @@ namespace masiina::runtime::parser
 
   static std::shared_ptr<plorth::array>
   parse_array(
-    FILE* input,
+    io::cursor& input,
     const std::shared_ptr<plorth::runtime>& runtime,
-    const symbol_map& symbol_map
+    const symbol_map& symbol_map,
+    position_table& positions,
+    const module::builtin_container_type* builtins
   )
   {
     std::uint32_t size;
     std::vector<std::shared_ptr<plorth::value>> elements;
 
-    if (!io::read_uint32(input, size))
+    if (!io::read_varint(input, size))
     {
       return nullptr;
     }
@@ -191,7 +456,13 @@ namespace masiina::runtime::parser
 
     for (std::uint32_t i = 0; i < size; ++i)
     {
-      const auto element = parse_instruction(input, runtime, symbol_map);
+      const auto element = parse_instruction(
+        input,
+        runtime,
+        symbol_map,
+        positions,
+        builtins
+      );
 
       if (!element)
       {
@@ -205,15 +476,18 @@ namespace masiina::runtime::parser
 
   static std::shared_ptr<plorth::quote>
   parse_quote(
-    FILE* input,
+    io::cursor& input,
     const std::shared_ptr<plorth::runtime>& runtime,
-    const symbol_map& symbol_map
+    const symbol_map& symbol_map,
+    position_table& positions,
+    const module::builtin_container_type* builtins
   )
   {
     std::uint32_t size;
     std::vector<std::shared_ptr<plorth::value>> children;
+    module::builtin_container_type bound_builtins;
 
-    if (!io::read_uint32(input, size))
+    if (!io::read_varint(input, size))
     {
       return nullptr;
     }
@@ -222,55 +496,99 @@ namespace masiina::runtime::parser
 
     for (std::uint32_t i = 0; i < size; ++i)
     {
-      const auto child = parse_instruction(input, runtime, symbol_map);
+      std::optional<std::uint16_t> builtin;
+      const auto child = parse_instruction(
+        input,
+        runtime,
+        symbol_map,
+        positions,
+        builtins,
+        &builtin
+      );
 
       if (!child)
       {
         return nullptr;
       }
       children.push_back(child);
+      if (builtins && builtin && (*builtins)[*builtin])
+      {
+        bound_builtins.resize(children.size());
+        bound_builtins.back() = (*builtins)[*builtin];
+      }
+    }
+
+    if (bound_builtins.empty())
+    {
+      return runtime->compiled_quote(children);
     }
 
-    return runtime->compiled_quote(children);
+    // Quotes which reference builtin words are executed by us instead of
+    // the interpreter, so that the builtin words can be called directly
+    // like the ones referenced by the module itself.
+    return runtime->native_quote(
+      [
+        children = std::move(children),
+        bound_builtins = std::move(bound_builtins)
+      ](const std::shared_ptr<plorth::context>& context)
+      {
+        for (std::size_t i = 0; i < children.size(); ++i)
+        {
+          if (!module::exec(
+            context,
+            children[i],
+            i < bound_builtins.size() ? bound_builtins[i] : nullptr
+          ))
+          {
+            return;
+          }
+        }
+      }
+    );
   }
 
   static std::shared_ptr<plorth::object>
   parse_object(
-    FILE* input,
+    io::cursor& input,
     const std::shared_ptr<plorth::runtime>& runtime,
-    const symbol_map& symbol_map
+    const symbol_map& symbol_map,
+    position_table& positions,
+    const module::builtin_container_type* builtins
   )
   {
     std::uint32_t size;
     std::vector<plorth::object::value_type> properties;
 
-    if (!io::read_uint32(input, size))
+    if (!io::read_varint(input, size))
     {
       return nullptr;
     }
 
     for (std::uint32_t i = 0; i < size; ++i)
     {
-      const int j = std::fgetc(input);
+      unsigned char j;
       std::u32string key;
       std::shared_ptr<plorth::value> value;
 
+      if (!io::read_byte(input, j))
+      {
+        return nullptr;
+      }
+
       switch (j)
       {
         case opcode::push_string_const:
         {
           std::uint32_t index;
 
-          if (!io::read_uint32(input, index))
+          if (!io::read_varint(input, index))
           {
             return nullptr;
           }
 
-          const auto k = symbol_map.find(index);
-
-          if (k != std::end(symbol_map))
+          if (index < symbol_map.size())
           {
-            key = k->second;
+            key = symbol_map[index].id;
           } else {
             return nullptr;
           }
@@ -287,7 +605,13 @@ namespace masiina::runtime::parser
         default:
           return nullptr;
       }
-      if (!(value = parse_instruction(input, runtime, symbol_map)))
+      if (!(value = parse_instruction(
+        input,
+        runtime,
+        symbol_map,
+        positions,
+        builtins
+      )))
       {
         return nullptr;
       }
@@ -297,8 +621,46 @@ namespace masiina::runtime::parser
     return runtime->object(properties);
   }
 
+  static std::shared_ptr<plorth::number>
+  parse_integer(
+    io::cursor& input,
+    const std::shared_ptr<plorth::runtime>& runtime
+  )
+  {
+    std::uint64_t value;
+
+    if (!io::read_uint64(input, value))
+    {
+      return nullptr;
+    }
+
+    return runtime->number(static_cast<plorth::number::int_type>(
+      static_cast<std::int64_t>(value)
+    ));
+  }
+
+  static std::shared_ptr<plorth::number>
+  parse_real(io::cursor& input, const std::shared_ptr<plorth::runtime>& runtime)
+  {
+    std::uint64_t bits;
+    double value;
+
+    static_assert(sizeof(bits) == sizeof(value));
+    if (!io::read_uint64(input, bits))
+    {
+      return nullptr;
+    }
+    std::memcpy(
+      static_cast<void*>(&value),
+      static_cast<const void*>(&bits),
+      sizeof(value)
+    );
+
+    return runtime->number(static_cast<plorth::number::real_type>(value));
+  }
+
   static std::shared_ptr<plorth::string>
-  parse_string(FILE* input, const std::shared_ptr<plorth::runtime>& runtime)
+  parse_string(io::cursor& input, const std::shared_ptr<plorth::runtime>& runtime)
   {
     std::u32string id;
 
@@ -312,135 +674,201 @@ namespace masiina::runtime::parser
 
   static std::shared_ptr<plorth::string>
   parse_string_const(
-    FILE* input,
+    io::cursor& input,
     const std::shared_ptr<plorth::runtime>& runtime,
     const symbol_map& symbol_map
   )
   {
     std::uint32_t index;
 
-    if (io::read_uint32(input, index))
+    if (io::read_varint(input, index) && index < symbol_map.size())
     {
-      const auto i = symbol_map.find(index);
+      const auto& entry = symbol_map[index];
 
-      if (i != std::end(symbol_map))
+      if (!entry.string)
       {
-        return runtime->string(i->second);
+        entry.string = runtime->string(entry.id);
       }
+
+      return entry.string;
     }
 
     return nullptr;
   }
 
-  static bool
-  parse_position(
-    FILE* input,
+  static std::shared_ptr<plorth::symbol>
+  parse_symbol(
+    io::cursor& input,
+    const std::shared_ptr<plorth::runtime>& runtime,
     const symbol_map& symbol_map,
-    plorth::parser::position& position
+    position_table& positions
   )
   {
-    std::uint32_t filename_index;
-    symbol_map::const_iterator filename_iterator;
-    std::uint16_t line;
-    std::uint16_t column;
+    std::u32string id;
+    std::optional<plorth::parser::position> position;
 
-    if (!io::read_uint32(input, filename_index))
+    if (!io::read_string(input, id))
     {
-      return false;
+      return nullptr;
     }
 
-    if ((filename_iterator = symbol_map.find(filename_index)) == std::end(symbol_map))
+    if (!positions.lookup(position))
     {
-      return false;
+      return nullptr;
     }
 
-    if (!io::read_uint16(input, line))
+    return runtime->symbol(id, position);
+  }
+
+  static std::shared_ptr<plorth::symbol>
+  parse_symbol_const(
+    io::cursor& input,
+    const std::shared_ptr<plorth::runtime>& runtime,
+    const symbol_map& symbol_map,
+    position_table& positions
+  )
+  {
+    std::uint32_t index;
+    std::optional<plorth::parser::position> position;
+
+    if (!io::read_varint(input, index) || index >= symbol_map.size())
     {
-      return false;
+      return nullptr;
     }
 
-    if (!io::read_uint16(input, column))
+    if (!positions.lookup(position))
     {
-      return false;
+      return nullptr;
     }
 
-    position.file = filename_iterator->second;
-    position.line = static_cast<int>(line);
-    position.column = static_cast<int>(column);
+    return runtime->symbol(symbol_map[index].id, position);
+  }
 
-    return true;
+  /**
+   * Returns identifiers of builtin words, indexed by their builtin index.
+   * The table is constructed only once per process.
+   */
+  static const std::vector<std::u32string>&
+  builtin_ids()
+  {
+    static const std::vector<std::u32string> ids(
+      builtins::words,
+      builtins::words + builtins::count
+    );
+
+    return ids;
   }
 
-  static std::shared_ptr<plorth::symbol>
-  parse_symbol(
-    FILE* input,
-    const std::shared_ptr<plorth::runtime>& runtime,
-    const symbol_map& symbol_map
-  )
+  /**
+   * Returns builtin index of the word with given identifier, or nothing if
+   * there is no such builtin word.
+   */
+  static std::optional<std::uint16_t>
+  find_builtin(const std::u32string& id)
   {
-    std::u32string id;
-    plorth::parser::position position;
+    const auto& ids = builtin_ids();
 
-    if (!io::read_string(input, id))
+    for (std::size_t i = 0; i < ids.size(); ++i)
     {
-      return nullptr;
+      if (ids[i] == id)
+      {
+        return static_cast<std::uint16_t>(i);
+      }
     }
 
-    if (!parse_position(input, symbol_map, position))
+    return std::nullopt;
+  }
+
+  /**
+   * Binds builtin indexes to native quotes of the words in the global
+   * dictionary of given runtime. This is done once for each compilation
+   * unit. Words which the runtime doesn't have are left unbound, and
+   * references to them are resolved by name.
+   */
+  static std::shared_ptr<const module::builtin_container_type>
+  bind_builtins(const std::shared_ptr<plorth::runtime>& runtime)
+  {
+    const auto& ids = builtin_ids();
+    auto builtins = std::make_shared<module::builtin_container_type>();
+
+    builtins->reserve(ids.size());
+    for (std::size_t i = 0; i < ids.size(); ++i)
     {
-      return nullptr;
+      const auto word = runtime->dictionary().find(ids[i]);
+
+      builtins->push_back(
+        word
+          ? std::make_shared<const module::builtin>(module::builtin{
+            static_cast<std::uint16_t>(i),
+            word->quote()
+          })
+          : nullptr
+      );
     }
 
-    return runtime->symbol(id, position);
+    return builtins;
   }
 
   static std::shared_ptr<plorth::symbol>
-  parse_symbol_const(
-    FILE* input,
+  parse_builtin(
+    io::cursor& input,
     const std::shared_ptr<plorth::runtime>& runtime,
-    const symbol_map& symbol_map
+    const symbol_map& symbol_map,
+    position_table& positions,
+    std::optional<std::uint16_t>* builtin
   )
   {
-    std::uint32_t index;
-    symbol_map::const_iterator iterator;
-    plorth::parser::position position;
+    const auto& ids = builtin_ids();
+    std::uint16_t index;
+    std::optional<plorth::parser::position> position;
 
-    if (!io::read_uint32(input, index))
+    if (!io::read_uint16(input, index) || index >= ids.size())
     {
       return nullptr;
     }
 
-    if ((iterator = symbol_map.find(index)) == std::end(symbol_map))
+    if (!positions.lookup(position))
     {
       return nullptr;
     }
 
-    if (!parse_position(input, symbol_map, position))
+    if (builtin)
     {
-      return nullptr;
+      *builtin = index;
     }
 
-    return runtime->symbol(iterator->second, position);
+    // Symbol is still needed for references which are not bound, and for
+    // resolving bound ones by name when the builtin word is shadowed.
+    return runtime->symbol(ids[index], position);
   }
 
   static std::shared_ptr<plorth::word>
   parse_word_declaration(
-    FILE* input,
+    io::cursor& input,
     const std::shared_ptr<plorth::runtime>& runtime,
-    const symbol_map& symbol_map
+    const symbol_map& symbol_map,
+    position_table& positions,
+    const module::builtin_container_type* builtins
   )
   {
     std::shared_ptr<plorth::symbol> symbol;
     std::shared_ptr<plorth::quote> quote;
+    unsigned char opcode;
+
+    if (!io::read_byte(input, opcode))
+    {
+      return nullptr;
+    }
+    positions.instruction();
 
-    switch (std::fgetc(input))
+    switch (opcode)
     {
       case opcode::push_symbol:
-        symbol = parse_symbol(input, runtime, symbol_map);
+        symbol = parse_symbol(input, runtime, symbol_map, positions);
         break;
 
       case opcode::push_symbol_const:
-        symbol = parse_symbol_const(input, runtime, symbol_map);
+        symbol = parse_symbol_const(input, runtime, symbol_map, positions);
         break;
     }
 
@@ -449,12 +877,18 @@ namespace masiina::runtime::parser
       return nullptr;
     }
 
-    if (std::fgetc(input) != opcode::push_quote)
+    if (const auto builtin = find_builtin(symbol->id()))
+    {
+      module::shadow_builtin(*builtin);
+    }
+
+    if (!io::read_byte(input, opcode) || opcode != opcode::push_quote)
     {
       return nullptr;
     }
+    positions.instruction();
 
-    if (!(quote = parse_quote(input, runtime, symbol_map)))
+    if (!(quote = parse_quote(input, runtime, symbol_map, positions, builtins)))
     {
       return nullptr;
     }
@@ -464,27 +898,38 @@ namespace masiina::runtime::parser
 
   static std::shared_ptr<plorth::value>
   parse_instruction(
-    FILE* input,
+    io::cursor& input,
     const std::shared_ptr<plorth::runtime>& runtime,
-    const symbol_map& symbol_map
+    const symbol_map& symbol_map,
+    position_table& positions,
+    const module::builtin_container_type* builtins,
+    std::optional<std::uint16_t>* builtin
   )
   {
-    int opcode = std::fgetc(input);
+    unsigned char opcode;
 
-    if (opcode == EOF)
+    if (!io::read_byte(input, opcode))
     {
       return nullptr;
     }
-    switch (static_cast<unsigned char>(opcode))
+    decoded_values.fetch_add(1, std::memory_order_relaxed);
+    positions.instruction();
+    switch (opcode)
     {
       case opcode::push_array:
-        return parse_array(input, runtime, symbol_map);
+        return parse_array(input, runtime, symbol_map, positions, builtins);
+
+      case opcode::push_integer:
+        return parse_integer(input, runtime);
 
       case opcode::push_quote:
-        return parse_quote(input, runtime, symbol_map);
+        return parse_quote(input, runtime, symbol_map, positions, builtins);
+
+      case opcode::push_real:
+        return parse_real(input, runtime);
 
       case opcode::push_object:
-        return parse_object(input, runtime, symbol_map);
+        return parse_object(input, runtime, symbol_map, positions, builtins);
 
       case opcode::push_string:
         return parse_string(input, runtime);
@@ -493,13 +938,22 @@ namespace masiina::runtime::parser
         return parse_string_const(input, runtime, symbol_map);
 
       case opcode::push_symbol:
-        return parse_symbol(input, runtime, symbol_map);
+        return parse_symbol(input, runtime, symbol_map, positions);
 
       case opcode::push_symbol_const:
-        return parse_symbol_const(input, runtime, symbol_map);
+        return parse_symbol_const(input, runtime, symbol_map, positions);
+
+      case opcode::call_builtin:
+        return parse_builtin(input, runtime, symbol_map, positions, builtin);
 
       case opcode::declare_word:
-        return parse_word_declaration(input, runtime, symbol_map);
+        return parse_word_declaration(
+          input,
+          runtime,
+          symbol_map,
+          positions,
+          builtins
+        );
     }
 
     return nullptr;
@@ -507,63 +961,210 @@ namespace masiina::runtime::parser
 
   static bool
   parse_module_name(
-    FILE* input,
+    io::cursor& input,
     const symbol_map& symbol_map,
     std::u32string& name
   )
   {
     std::uint32_t index;
-    symbol_map::const_iterator iterator;
-
-    if (!io::read_uint32(input, index))
-    {
-      return false;
-    }
 
-    if ((iterator = symbol_map.find(index)) == std::end(symbol_map))
+    if (!io::read_uint32(input, index) || index >= symbol_map.size())
     {
       return false;
     }
 
-    name = iterator->second;
+    name = symbol_map[index].id;
 
     return true;
   }
 
   static std::optional<std::string>
-  parse_module(
-    FILE* input,
+  parse_module_values(
+    io::cursor& input,
     const std::shared_ptr<plorth::runtime>& runtime,
     const symbol_map& symbol_map,
-    std::vector<std::shared_ptr<module>>& container
+    const module::builtin_container_type& builtins,
+    bool bind_quotes,
+    position_table& positions,
+    module::container_type& values,
+    module::builtin_container_type& bound_builtins
   )
   {
-    std::u32string name;
     std::uint32_t size;
-    module::container_type values;
-
-    if (!parse_module_name(input, symbol_map, name))
-    {
-      return std::make_optional<std::string>("Unable to import module name.");
-    }
 
-    if (!io::read_uint32(input, size))
+    if (!io::read_varint(input, size))
     {
       return std::make_optional<std::string>("Unable to import module size.");
     }
 
+    values.reserve(size);
+
     for (std::uint32_t i = 0; i < size; ++i)
     {
-      const auto value = parse_instruction(input, runtime, symbol_map);
+      std::optional<std::uint16_t> builtin;
+      const auto value = parse_instruction(
+        input,
+        runtime,
+        symbol_map,
+        positions,
+        bind_quotes ? &builtins : nullptr,
+        &builtin
+      );
 
       if (!value)
       {
         return std::make_optional<std::string>("Unable to import module.");
       }
       values.push_back(value);
+
+      // References to builtin words which are executed directly by the
+      // module are bound to their native quotes.
+      if (builtin && builtins[*builtin])
+      {
+        bound_builtins.resize(values.size());
+        bound_builtins.back() = builtins[*builtin];
+      }
+    }
+
+    if (input.current != input.end)
+    {
+      return std::make_optional<std::string>("Unable to import module.");
     }
 
-    container.push_back(std::make_shared<module>(name, values));
+    return std::nullopt;
+  }
+
+  /**
+   * Decompresses bytecode or debug info of an module, which begins with
+   * it's decompressed size, into an heap allocated buffer and points given
+   * cursor to the decompressed data. Returns null pointer if the data is
+   * malformed.
+   */
+  static std::shared_ptr<const io::buffer>
+  decompress_section(io::cursor& input)
+  {
+    std::uint32_t size;
+    std::shared_ptr<const io::buffer> result;
+
+    if (!io::read_uint32(input, size)
+        || !(result = io::buffer::decompress(
+          input.current,
+          static_cast<std::size_t>(input.end - input.current),
+          size
+        )))
+    {
+      return nullptr;
+    }
+    input.current = result->data();
+    input.end = result->data() + result->size();
+
+    return result;
+  }
+
+  static std::optional<std::string>
+  parse_module(
+    io::cursor& input,
+    const std::shared_ptr<const io::buffer>& buffer,
+    const std::shared_ptr<const symbol_map>& symbol_map,
+    const std::shared_ptr<const module::builtin_container_type>& builtins,
+    const unsigned char* section,
+    std::size_t section_size,
+    unsigned char flags,
+    std::uint64_t unit_hash,
+    std::vector<std::shared_ptr<module>>& container
+  )
+  {
+    std::u32string name;
+    std::uint32_t offset;
+    std::uint32_t length;
+    std::uint32_t debug_offset = 0;
+    std::uint32_t debug_length = 0;
+    const unsigned char* begin;
+    const unsigned char* debug_begin;
+
+    if (!parse_module_name(input, *symbol_map, name))
+    {
+      return std::make_optional<std::string>("Unable to import module name.");
+    }
+
+    if (!io::read_uint32(input, offset) || !io::read_uint32(input, length))
+    {
+      return std::make_optional<std::string>("Unable to import module offset.");
+    }
+
+    if ((flags & flags::debug_info)
+        && (!io::read_uint32(input, debug_offset)
+          || !io::read_uint32(input, debug_length)))
+    {
+      return std::make_optional<std::string>("Unable to import module offset.");
+    }
+
+    if (offset > section_size
+        || length > section_size - offset
+        || debug_offset > section_size
+        || debug_length > section_size - debug_offset)
+    {
+      return std::make_optional<std::string>("Module offset out of bounds.");
+    }
+    begin = section + offset;
+    debug_begin = section + debug_offset;
+
+    // Values of the module are decoded only once the module is being
+    // imported for the first time. The decoder keeps both the buffer and the
+    // symbol table alive until then. Debug info is only read along with the
+    // module, so pages containing debug info of modules which are never
+    // imported are never touched. Bytecode and debug info of modules in
+    // compressed units are compressed separately, so only the module which
+    // is being decoded is decompressed, and the decompressed data is
+    // released once the values have been decoded.
+    container.push_back(std::make_shared<module>(
+      name,
+      [
+        buffer,
+        symbol_map,
+        builtins,
+        begin,
+        length,
+        debug_begin,
+        debug_length,
+        compressed = (flags & flags::compressed) != 0
+      ](
+        const std::shared_ptr<plorth::runtime>& runtime,
+        bool bind_quotes,
+        module::container_type& values,
+        module::builtin_container_type& bound_builtins
+      ) -> std::optional<std::string>
+      {
+        io::cursor input = { begin, begin + length };
+        io::cursor debug_input = { debug_begin, debug_begin + debug_length };
+        std::shared_ptr<const io::buffer> bytecode;
+        std::shared_ptr<const io::buffer> debug_info;
+
+        if (compressed
+            && (!(bytecode = decompress_section(input))
+              || (debug_length > 0
+                && !(debug_info = decompress_section(debug_input)))))
+        {
+          return std::make_optional<std::string>(
+            "Unable to decompress module."
+          );
+        }
+
+        position_table positions(debug_input, *symbol_map);
+
+        return parse_module_values(
+          input,
+          runtime,
+          *symbol_map,
+          *builtins,
+          bind_quotes,
+          positions,
+          values,
+          bound_builtins
+        );
+      },
+      unit_hash
+    ));
 
     return std::nullopt;
   }
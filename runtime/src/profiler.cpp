@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cerrno>
+#include <cstdio>
+#include <map>
+
+#include <masiina/runtime/config.hpp>
+#include <masiina/runtime/profiler.hpp>
+#include <masiina/runtime/routine.hpp>
+#include <peelo/unicode/encoding/utf8.hpp>
+
+#if defined(HAVE_SETITIMER)
+# include <signal.h>
+# include <sys/time.h>
+#endif
+
+namespace masiina::runtime
+{
+  // Depth recorded for samples taken while no routine was being executed.
+  static const std::uint32_t no_routine = UINT32_MAX;
+
+  static std::atomic<profiler*> active_profiler(nullptr);
+
+  profiler*
+  profiler::current()
+  {
+    return active_profiler.load(std::memory_order_acquire);
+  }
+
+  profiler::profiler(std::size_t sample_capacity)
+    : m_sample_capacity(sample_capacity)
+    , m_samples(new std::uint32_t[sample_capacity])
+    , m_sample_size(0)
+    , m_dropped_samples(0)
+    , m_active_stack(nullptr) {}
+
+  profiler::~profiler()
+  {
+    stop();
+  }
+
+  bool
+  profiler::start(long interval)
+  {
+#if defined(HAVE_SETITIMER)
+    struct sigaction action = {};
+    struct itimerval timer = {};
+
+    action.sa_handler = handle_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) < 0)
+    {
+      return false;
+    }
+
+    active_profiler.store(this, std::memory_order_release);
+
+    timer.it_interval.tv_sec = interval / 1000000;
+    timer.it_interval.tv_usec = interval % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) < 0)
+    {
+      active_profiler.store(nullptr, std::memory_order_release);
+
+      return false;
+    }
+
+    return true;
+#else
+    errno = ENOSYS;
+
+    return false;
+#endif
+  }
+
+  void
+  profiler::stop()
+  {
+#if defined(HAVE_SETITIMER)
+    if (current() == this)
+    {
+      struct itimerval timer = {};
+
+      setitimer(ITIMER_PROF, &timer, nullptr);
+      active_profiler.store(nullptr, std::memory_order_release);
+    }
+#endif
+  }
+
+  void
+  profiler::instrument(
+    const std::shared_ptr<plorth::runtime>& runtime,
+    module::container_type& values
+  )
+  {
+    for (auto& value : values)
+    {
+      value = instrument(runtime, value);
+    }
+  }
+
+  std::shared_ptr<plorth::value>
+  profiler::instrument(
+    const std::shared_ptr<plorth::runtime>& runtime,
+    const std::shared_ptr<plorth::value>& value
+  )
+  {
+    if (!value)
+    {
+      return value;
+    }
+    else if (value->type() == plorth::value::type::word)
+    {
+      const auto word = std::static_pointer_cast<plorth::word>(value);
+      const auto& symbol = word->symbol();
+      const auto& position = symbol->position();
+      const auto quote = std::static_pointer_cast<plorth::quote>(
+        instrument(runtime, word->quote())
+      );
+      const auto frame = static_cast<std::uint32_t>(m_frame_names.size());
+      auto name = peelo::unicode::encoding::utf8::encode(symbol->id());
+
+      if (position)
+      {
+        name += " (";
+        name += peelo::unicode::encoding::utf8::encode(position->file);
+        name += ":";
+        name += std::to_string(position->line);
+        name += ")";
+      }
+      // Semicolons separate frames in the collapsed stack format.
+      for (auto& c : name)
+      {
+        if (c == ';')
+        {
+          c = ':';
+        }
+      }
+      m_frame_names.push_back(name);
+
+      return runtime->word(symbol, runtime->native_quote(
+        [quote, frame](const std::shared_ptr<plorth::context>& context)
+        {
+          const auto routine = routine::current();
+          const auto stack = routine ? routine->call_stack() : nullptr;
+
+          if (stack)
+          {
+            stack->push(frame);
+          }
+          quote->call(context);
+          if (stack)
+          {
+            stack->pop();
+          }
+        }
+      ));
+    }
+    else if (value->type() == plorth::value::type::quote)
+    {
+      const auto quote = std::static_pointer_cast<plorth::quote>(value);
+
+      if (quote->quote_type() == plorth::quote::quote_type::compiled)
+      {
+        auto children = std::static_pointer_cast<plorth::compiled_quote>(
+          quote
+        )->children();
+
+        instrument(runtime, children);
+
+        return runtime->compiled_quote(children);
+      }
+    }
+
+    return value;
+  }
+
+  bool
+  profiler::write(const std::string& path) const
+  {
+    const auto size = std::min<std::size_t>(m_sample_size, m_sample_capacity);
+    std::map<std::string, std::size_t> stacks;
+    std::FILE* output;
+
+    for (std::size_t offset = 0; offset < size;)
+    {
+      const auto depth = m_samples[offset++];
+      std::string stack;
+
+      if (depth == no_routine)
+      {
+        stack = "(runtime)";
+      }
+      else if (!depth)
+      {
+        stack = "(top level)";
+      } else {
+        for (std::uint32_t i = 0; i < depth; ++i)
+        {
+          if (i > 0)
+          {
+            stack += ';';
+          }
+          stack += m_frame_names[m_samples[offset + i]];
+        }
+        offset += depth;
+      }
+      ++stacks[stack];
+    }
+
+    if (!(output = std::fopen(path.c_str(), "w")))
+    {
+      return false;
+    }
+    for (const auto& stack : stacks)
+    {
+      std::fprintf(output, "%s %zu\n", stack.first.c_str(), stack.second);
+    }
+
+    return !std::fclose(output);
+  }
+
+  void
+  profiler::handle_signal(int)
+  {
+    const auto saved_errno = errno;
+
+    if (const auto profiler = current())
+    {
+      profiler->sample();
+    }
+    errno = saved_errno;
+  }
+
+  void
+  profiler::sample()
+  {
+    const auto stack = m_active_stack.load(std::memory_order_acquire);
+    const auto depth = stack
+      ? std::min(stack->depth.load(std::memory_order_acquire), call_stack::max_depth)
+      : 0;
+    auto offset = m_sample_size.load(std::memory_order_relaxed);
+
+    // Reserve room for the sample, which may be taken simultaneously in
+    // multiple threads.
+    do
+    {
+      if (offset + depth + 1 > m_sample_capacity)
+      {
+        ++m_dropped_samples;
+        return;
+      }
+    }
+    while (!m_sample_size.compare_exchange_weak(offset, offset + depth + 1));
+
+    m_samples[offset] = stack ? static_cast<std::uint32_t>(depth) : no_routine;
+    for (std::size_t i = 0; i < depth; ++i)
+    {
+      m_samples[offset + 1 + i] = stack->frames[i];
+    }
+  }
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cerrno>
+#include <thread>
+
+#include <masiina/runtime/config.hpp>
+#include <masiina/runtime/reactor.hpp>
+
+#if defined(HAVE_SYS_EPOLL_H)
+# define USE_EPOLL 1
+# include <sys/epoll.h>
+# include <unistd.h>
+#endif
+
+namespace masiina::runtime
+{
+  // Maximum number of events processed on each call to poll().
+  static const int max_events = 64;
+
+  reactor::reactor()
+    : m_poll_fd(-1)
+  {
+    open();
+  }
+
+  reactor::~reactor()
+  {
+    close();
+  }
+
+  void
+  reactor::reopen()
+  {
+    close();
+    open();
+  }
+
+  void
+  reactor::open()
+  {
+#if defined(USE_EPOLL)
+    m_poll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+#endif
+  }
+
+  void
+  reactor::close()
+  {
+#if defined(USE_EPOLL)
+    if (m_poll_fd >= 0)
+    {
+      ::close(m_poll_fd);
+      m_poll_fd = -1;
+    }
+#endif
+  }
+
+  bool
+  reactor::wait(routine& routine, int fd, interest interest)
+  {
+#if defined(USE_EPOLL)
+    struct epoll_event event = {};
+
+    if (m_poll_fd < 0)
+    {
+      return true;
+    }
+
+    event.events = interest == interest::read ? EPOLLIN : EPOLLOUT;
+    event.data.fd = fd;
+
+    if (m_waiting_routines.find(fd) != std::end(m_waiting_routines))
+    {
+      errno = EBUSY;
+
+      return false;
+    }
+    else if (::epoll_ctl(m_poll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+      // Regular files cannot be polled, as they are always ready.
+      return errno == EPERM;
+    }
+    m_waiting_routines[fd] = routine.shared_from_this();
+    routine.park();
+#endif
+
+    return true;
+  }
+
+  std::vector<std::shared_ptr<routine>>
+  reactor::poll(int timeout)
+  {
+    std::vector<std::shared_ptr<routine>> ready;
+#if defined(USE_EPOLL)
+    struct epoll_event events[max_events];
+    int count;
+
+    if (m_poll_fd < 0)
+    {
+      return ready;
+    }
+
+    do
+    {
+      count = ::epoll_wait(m_poll_fd, events, max_events, timeout);
+    }
+    while (count < 0 && errno == EINTR);
+
+    for (int i = 0; i < count; ++i)
+    {
+      const int fd = events[i].data.fd;
+      const auto index = m_waiting_routines.find(fd);
+
+      ::epoll_ctl(m_poll_fd, EPOLL_CTL_DEL, fd, nullptr);
+      if (index != std::end(m_waiting_routines))
+      {
+        ready.push_back(std::move(index->second));
+        m_waiting_routines.erase(index);
+      }
+    }
+#else
+    // Without epoll there are no descriptors to wait for, so just wait
+    // until the timeout expires.
+    if (timeout > 0)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+    }
+#endif
+
+    return ready;
+  }
+}
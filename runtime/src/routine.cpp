@@ -23,16 +23,110 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <cstdlib>
+#include <new>
+
+#include <ucontext.h>
+
+#include <masiina/runtime/config.hpp>
+#include <masiina/runtime/environment.hpp>
+#include <masiina/runtime/profiler.hpp>
 #include <masiina/runtime/routine.hpp>
 
+#if defined(HAVE_MMAP)
+# include <sys/mman.h>
+#endif
+
+#if defined(HAVE_MMAP) && !defined(MAP_ANONYMOUS)
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#if defined(HAVE_MMAP) && !defined(MAP_NORESERVE)
+# define MAP_NORESERVE 0
+#endif
+
 namespace masiina::runtime
 {
+  using clock = std::chrono::steady_clock;
+
+  static thread_local routine* current_routine = nullptr;
+
+  struct routine::coroutine
+  {
+    ucontext_t context;
+    ucontext_t caller;
+    void* stack;
+    const std::size_t stack_size;
+
+    // When mmap is available, pages of the stack are reserved only when they
+    // are being used.
+    explicit coroutine(std::size_t size)
+      : stack_size(size)
+    {
+#if defined(HAVE_MMAP)
+      stack = ::mmap(
+        nullptr,
+        stack_size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1,
+        0
+      );
+      if (stack == MAP_FAILED)
+      {
+        throw std::bad_alloc();
+      }
+      // Use lowest page of the stack as guard page, so that stack overflow
+      // results in crash instead of memory corruption.
+      ::mprotect(stack, 4096, PROT_NONE);
+#else
+      if (!(stack = std::malloc(stack_size)))
+      {
+        throw std::bad_alloc();
+      }
+#endif
+      ::getcontext(&context);
+      context.uc_stack.ss_sp = stack;
+      context.uc_stack.ss_size = stack_size;
+      context.uc_link = nullptr;
+      ::makecontext(&context, &routine::run, 0);
+    }
+
+    ~coroutine()
+    {
+#if defined(HAVE_MMAP)
+      ::munmap(stack, stack_size);
+#else
+      std::free(stack);
+#endif
+    }
+  };
+
   routine::routine(
+    class environment& environment,
+    id_type id,
     const std::shared_ptr<plorth::context>& context,
-    const std::vector<std::shared_ptr<plorth::value>>& values
+    const std::vector<std::shared_ptr<plorth::value>>& values,
+    const module::builtin_container_type& builtins
   )
-    : m_context(context)
-    , m_values(values) {}
+    : m_environment(environment)
+    , m_id(id)
+    , m_context(context)
+    , m_values(values)
+    , m_builtins(builtins)
+    , m_offset(0)
+    , m_yield_requested(false)
+    , m_parked(false)
+    , m_quantum({ 0, std::chrono::microseconds(0) })
+    , m_executed(0) {}
+
+  routine::~routine() {}
+
+  routine*
+  routine::current()
+  {
+    return current_routine;
+  }
 
   bool
   routine::is_finished() const
@@ -41,18 +135,118 @@ namespace masiina::runtime
   }
 
   bool
-  routine::step()
+  routine::step(const struct quantum& quantum)
   {
-    if (m_offset < m_values.size())
+    const auto previous_routine = current_routine;
+
+    if (is_finished())
     {
-      if (!plorth::value::exec(m_context, m_values[m_offset++]))
-      {
-        m_offset = m_values.size() + 1;
+      return true;
+    }
+    else if (!m_coroutine)
+    {
+      m_coroutine = std::make_unique<coroutine>(m_environment.stack_size());
+    }
 
-        return false;
+    m_quantum = quantum;
+    m_executed = 0;
+    if (quantum.duration.count() > 0)
+    {
+      m_deadline = clock::now() + quantum.duration;
+    }
+    m_yield_requested = false;
+    current_routine = this;
+    if (const auto profiler = profiler::current())
+    {
+      if (!m_call_stack)
+      {
+        m_call_stack = std::make_unique<struct call_stack>();
       }
+      profiler->switch_to(m_call_stack.get());
+      ::swapcontext(&m_coroutine->caller, &m_coroutine->context);
+      profiler->switch_to(
+        previous_routine ? previous_routine->m_call_stack.get() : nullptr
+      );
+    } else {
+      ::swapcontext(&m_coroutine->caller, &m_coroutine->context);
+    }
+    current_routine = previous_routine;
+
+    if (is_finished())
+    {
+      m_coroutine.reset();
+
+      return !m_error;
     }
 
     return true;
   }
+
+  void
+  routine::park()
+  {
+    m_parked = true;
+    suspend();
+  }
+
+  void
+  routine::wait(routine& waiting)
+  {
+    while (!is_finished())
+    {
+      m_waiting_routines.push_back(waiting.shared_from_this());
+      waiting.park();
+    }
+  }
+
+  void
+  routine::run()
+  {
+    // Routine which is being started is always the current one, as
+    // arguments given to makecontext() cannot portably carry pointers.
+    const auto routine = current_routine;
+
+    while (routine->m_offset < routine->m_values.size())
+    {
+      const auto offset = routine->m_offset;
+
+      // Offset is advanced only after the value has been executed, as the
+      // routine may be parked in the middle of it.
+      if (!module::exec(
+        routine->m_context,
+        routine->m_values[offset],
+        offset < routine->m_builtins.size()
+          ? routine->m_builtins[offset]
+          : nullptr
+      ))
+      {
+        routine->m_offset = routine->m_values.size() + 1;
+        routine->m_error = routine->m_context->error();
+        break;
+      }
+      ++routine->m_offset;
+      if (routine->is_turn_over())
+      {
+        routine->suspend();
+      }
+    }
+
+    // Routine has finished, so return to the caller for the last time. Stack
+    // of the routine is released after this.
+    ::setcontext(&routine->m_coroutine->caller);
+  }
+
+  void
+  routine::suspend()
+  {
+    ::swapcontext(&m_coroutine->context, &m_coroutine->caller);
+  }
+
+  bool
+  routine::is_turn_over()
+  {
+    return m_yield_requested
+      || (m_quantum.values > 0 && ++m_executed >= m_quantum.values)
+      || (m_quantum.duration.count() > 0 && clock::now() >= m_deadline);
+  }
 }
@@ -0,0 +1,517 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <masiina/runtime/config.hpp>
+#include <masiina/runtime/server.hpp>
+#include <peelo/unicode/encoding/utf8.hpp>
+
+#if defined(HAVE_FORK) && defined(HAVE_SYS_UN_H)
+# define USE_SERVER 1
+# include <poll.h>
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/un.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
+namespace masiina::runtime
+{
+#if defined(USE_SERVER)
+  static volatile std::sig_atomic_t shutdown_requested = 0;
+  static sigset_t original_signal_mask;
+
+  static void
+  handle_shutdown_signal(int)
+  {
+    shutdown_requested = 1;
+  }
+
+  static void
+  handle_child_signal(int) {}
+
+  static std::string
+  error_message(const std::string& message)
+  {
+    return message + ": " + std::strerror(errno);
+  }
+
+  /**
+   * Reads NUL terminated arguments from given connection until an empty
+   * one is encountered. The arguments are read one byte at a time, so that
+   * nothing following them is consumed, as that belongs to the standard
+   * input of the job.
+   */
+  static bool
+  read_arguments(int connection, std::vector<std::u32string>& arguments)
+  {
+    std::string argument;
+    std::size_t size = 0;
+
+    for (;;)
+    {
+      char c;
+      const auto result = ::read(connection, &c, 1);
+
+      if (result < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+
+        return false;
+      }
+      else if (!result || ++size > server::max_arguments_size)
+      {
+        return false;
+      }
+      else if (c)
+      {
+        argument.push_back(c);
+      }
+      else if (argument.empty())
+      {
+        return true;
+      } else {
+        arguments.push_back(peelo::unicode::encoding::utf8::decode(argument));
+        argument.clear();
+      }
+    }
+  }
+
+  static bool
+  write_fully(int fd, const char* data, std::size_t size)
+  {
+    while (size > 0)
+    {
+      const auto result = ::write(fd, data, size);
+
+      if (result < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+
+        return false;
+      }
+      data += result;
+      size -= static_cast<std::size_t>(result);
+    }
+
+    return true;
+  }
+
+  static bool
+  write_record(
+    int connection,
+    server::record_type type,
+    const char* data,
+    std::size_t size
+  )
+  {
+    const char header[] =
+    {
+      static_cast<char>(type),
+      static_cast<char>((size >> 0) & 0xff),
+      static_cast<char>((size >> 8) & 0xff),
+      static_cast<char>((size >> 16) & 0xff),
+      static_cast<char>((size >> 24) & 0xff),
+    };
+
+    return write_fully(connection, header, sizeof(header))
+      && write_fully(connection, data, size);
+  }
+
+  /**
+   * Reads data written into standard output and standard error of an job
+   * from given pipes and sends it to the client as records, until both of
+   * the pipes have been closed. The pipes are drained even if the client
+   * has disconnected, so that the job never blocks on writing it's output.
+   */
+  static void
+  forward_output(int connection, int output_pipe, int error_pipe)
+  {
+    struct pollfd fds[2] = {
+      { output_pipe, POLLIN, 0 },
+      { error_pipe, POLLIN, 0 },
+    };
+    int open_count = 2;
+    bool connected = true;
+    char buffer[4096];
+
+    while (open_count > 0)
+    {
+      if (::poll(fds, 2, -1) < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        break;
+      }
+      for (auto& fd : fds)
+      {
+        if (fd.fd < 0 || !fd.revents)
+        {
+          continue;
+        }
+
+        const auto result = ::read(fd.fd, buffer, sizeof(buffer));
+
+        if (result < 0 && errno == EINTR)
+        {
+          continue;
+        }
+        else if (result <= 0)
+        {
+          // Negative descriptors are ignored by poll().
+          fd.fd = -1;
+          --open_count;
+          continue;
+        }
+        if (connected)
+        {
+          connected = write_record(
+            connection,
+            &fd == fds
+              ? server::record_type::output
+              : server::record_type::error,
+            buffer,
+            static_cast<std::size_t>(result)
+          );
+        }
+      }
+    }
+  }
+#endif
+
+  server::server(
+    class environment& environment,
+    const std::shared_ptr<module>& main_module,
+    std::size_t worker_count,
+    std::size_t max_jobs
+  )
+    : m_environment(environment)
+    , m_main_module(main_module)
+    , m_worker_count(worker_count > 0 ? worker_count : 1)
+    , m_max_jobs(max_jobs)
+    , m_socket(-1) {}
+
+  bool
+  server::is_supported()
+  {
+#if defined(USE_SERVER)
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  std::optional<std::string>
+  server::run(const std::string& path)
+  {
+#if defined(USE_SERVER)
+    struct sockaddr_un address = {};
+    struct sigaction action = {};
+    struct stat st;
+    sigset_t signals;
+
+    if (path.length() >= sizeof(address.sun_path))
+    {
+      return std::make_optional<std::string>("Socket path is too long.");
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    // Remove socket left behind by an previous server, but nothing else.
+    if (!::stat(path.c_str(), &st) && S_ISSOCK(st.st_mode))
+    {
+      ::unlink(path.c_str());
+    }
+
+    if ((m_socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+      return error_message("Unable to create socket");
+    }
+    if (::bind(
+          m_socket,
+          reinterpret_cast<const struct sockaddr*>(&address),
+          sizeof(address)
+        ) < 0
+        || ::listen(m_socket, SOMAXCONN) < 0)
+    {
+      const auto error = error_message("Unable to listen to `" + path + "'");
+
+      ::close(m_socket);
+      m_socket = -1;
+
+      return error;
+    }
+    m_path = path;
+
+    // Signals are blocked except while waiting for them with sigsuspend(),
+    // so that none of them can be missed between checking the flags and
+    // starting to wait.
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGCHLD);
+    ::sigprocmask(SIG_BLOCK, &signals, &original_signal_mask);
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = handle_shutdown_signal;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+    action.sa_handler = handle_child_signal;
+    ::sigaction(SIGCHLD, &action, nullptr);
+
+    for (;;)
+    {
+      bool crashed = false;
+      pid_t pid;
+      int status;
+
+      while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+      {
+        m_workers.erase(static_cast<long>(pid));
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        {
+          crashed = true;
+        }
+      }
+      if (shutdown_requested)
+      {
+        break;
+      }
+      // Avoid spinning if the workers keep failing right after they have
+      // been started.
+      if (crashed)
+      {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+      }
+      while (m_workers.size() < m_worker_count)
+      {
+        if (!fork_worker())
+        {
+          const auto error = error_message("Unable to fork worker");
+
+          shutdown();
+          ::sigprocmask(SIG_SETMASK, &original_signal_mask, nullptr);
+
+          return error;
+        }
+      }
+      ::sigsuspend(&original_signal_mask);
+    }
+
+    shutdown();
+    ::sigprocmask(SIG_SETMASK, &original_signal_mask, nullptr);
+
+    return std::nullopt;
+#else
+    return std::make_optional<std::string>(
+      "Server mode is not supported on this platform."
+    );
+#endif
+  }
+
+  bool
+  server::fork_worker()
+  {
+#if defined(USE_SERVER)
+    const auto pid = ::fork();
+
+    if (pid < 0)
+    {
+      return false;
+    }
+    else if (!pid)
+    {
+      work();
+      std::exit(EXIT_SUCCESS);
+    }
+    m_workers.insert(static_cast<long>(pid));
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void
+  server::work()
+  {
+#if defined(USE_SERVER)
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    std::signal(SIGCHLD, SIG_DFL);
+    // Clients disconnecting before the job has finished should not kill
+    // the worker.
+    std::signal(SIGPIPE, SIG_IGN);
+    ::sigprocmask(SIG_SETMASK, &original_signal_mask, nullptr);
+    m_environment.reactor().reopen();
+
+    for (std::size_t jobs = 0; !m_max_jobs || jobs < m_max_jobs;)
+    {
+      const int connection = ::accept(m_socket, nullptr, nullptr);
+
+      if (connection < 0)
+      {
+        if (errno == EINTR || errno == ECONNABORTED)
+        {
+          continue;
+        }
+        std::cerr << error_message("Unable to accept connection") << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      serve(connection);
+      ++jobs;
+    }
+#endif
+  }
+
+  void
+  server::serve(int connection)
+  {
+#if defined(USE_SERVER)
+    std::vector<std::u32string> arguments;
+    int saved_descriptors[3];
+    int output_pipe[2];
+    int error_pipe[2];
+    std::thread forwarder;
+    bool error_occurred = false;
+    char status;
+
+    if (!read_arguments(connection, arguments))
+    {
+      ::close(connection);
+      return;
+    }
+    if (::pipe(output_pipe) < 0)
+    {
+      ::close(connection);
+      return;
+    }
+    if (::pipe(error_pipe) < 0)
+    {
+      ::close(output_pipe[0]);
+      ::close(output_pipe[1]);
+      ::close(connection);
+      return;
+    }
+
+    // Standard input of the worker is replaced with the connection and
+    // standard output and standard error with pipes for the duration of the
+    // job. Only the worker keeps the writing ends of the pipes open, so the
+    // forwarding thread sees end of them once they have been restored.
+    for (int fd = 0; fd < 3; ++fd)
+    {
+      saved_descriptors[fd] = ::dup(fd);
+    }
+    ::dup2(connection, STDIN_FILENO);
+    ::dup2(output_pipe[1], STDOUT_FILENO);
+    ::dup2(error_pipe[1], STDERR_FILENO);
+    ::close(output_pipe[1]);
+    ::close(error_pipe[1]);
+    forwarder = std::thread(
+      forward_output,
+      connection,
+      output_pipe[0],
+      error_pipe[0]
+    );
+
+    m_environment.runtime()->arguments() = arguments;
+    m_environment.input_buffers().clear();
+    m_environment.spawn(m_main_module);
+    while (!m_environment.is_finished())
+    {
+      if (m_environment.step())
+      {
+        error_occurred = true;
+      }
+    }
+
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(nullptr);
+    // Writes fail if the client has disconnected, which leaves the streams
+    // in failed state.
+    std::cout.clear();
+    std::cerr.clear();
+    for (int fd = 0; fd < 3; ++fd)
+    {
+      if (saved_descriptors[fd] >= 0)
+      {
+        ::dup2(saved_descriptors[fd], fd);
+        ::close(saved_descriptors[fd]);
+      } else {
+        ::close(fd);
+      }
+    }
+
+    forwarder.join();
+    ::close(output_pipe[0]);
+    ::close(error_pipe[0]);
+
+    // Output of the job has been sent, so the exit status follows it as the
+    // last record before the connection is closed. Client may have already
+    // disconnected, in which case there is nobody to report the status to.
+    status = static_cast<char>(error_occurred ? EXIT_FAILURE : EXIT_SUCCESS);
+    write_record(connection, record_type::status, &status, 1);
+    ::close(connection);
+#endif
+  }
+
+  void
+  server::shutdown()
+  {
+#if defined(USE_SERVER)
+    for (const auto pid : m_workers)
+    {
+      ::kill(static_cast<pid_t>(pid), SIGTERM);
+    }
+    for (const auto pid : m_workers)
+    {
+      ::waitpid(static_cast<pid_t>(pid), nullptr, 0);
+    }
+    m_workers.clear();
+    if (m_socket >= 0)
+    {
+      ::close(m_socket);
+      m_socket = -1;
+      ::unlink(m_path.c_str());
+    }
+#endif
+  }
+}
@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+#include <masiina/flags.hpp>
+#include <masiina/opcode.hpp>
+#include <masiina/runtime/io.hpp>
+#include <masiina/runtime/snapshot.hpp>
+#include <masiina/version.hpp>
+
+namespace masiina::runtime::snapshot
+{
+  /**
+   * Encodes values back into bytecode, using the same instructions the
+   * compiler would use for them.
+   */
+  class encoder
+  {
+  public:
+    explicit encoder()
+      : m_debug_info(nullptr)
+      , m_instruction_count(0)
+      , m_next_instruction(0)
+      , m_line(0) {}
+
+    std::uint32_t
+    add_symbol(const std::u32string& str)
+    {
+      const auto index = m_symbol_index.find(str);
+      std::uint32_t result;
+
+      if (index != std::end(m_symbol_index))
+      {
+        return index->second;
+      }
+      result = static_cast<std::uint32_t>(m_symbols.size());
+      m_symbols.push_back(str);
+      m_symbol_index[str] = result;
+
+      return result;
+    }
+
+    /**
+     * Encodes exported words of an module as word declarations, and source
+     * code positions of the symbols into debug info. Returns false if any of
+     * them cannot be encoded.
+     */
+    bool
+    encode_module(
+      const std::shared_ptr<plorth::object>& object,
+      std::vector<unsigned char>& output,
+      std::vector<unsigned char>& debug_info
+    )
+    {
+      const auto& entries = object->entries();
+
+      m_debug_info = &debug_info;
+      m_instruction_count = 0;
+      m_next_instruction = 0;
+      m_file.reset();
+      m_line = 0;
+      io::write_varint(output, static_cast<std::uint32_t>(entries.size()));
+      for (const auto& entry : entries)
+      {
+        if (!entry.second
+            || entry.second->type() != plorth::value::type::quote)
+        {
+          return false;
+        }
+        write_opcode(opcode::declare_word, output);
+        write_opcode(opcode::push_symbol_const, output);
+        io::write_varint(output, add_symbol(entry.first));
+        if (!encode(entry.second, output))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    bool
+    encode(
+      const std::shared_ptr<plorth::value>& value,
+      std::vector<unsigned char>& output
+    )
+    {
+      // Null, booleans and errors only come into existence when code is
+      // being executed, so there are no instructions for them.
+      if (!value)
+      {
+        return false;
+      }
+
+      switch (value->type())
+      {
+        case plorth::value::type::number:
+          encode_number(std::static_pointer_cast<plorth::number>(value), output);
+          return true;
+
+        case plorth::value::type::string:
+          write_opcode(opcode::push_string_const, output);
+          io::write_varint(output, add_symbol(value->to_string()));
+          return true;
+
+        case plorth::value::type::array:
+          return encode_array(
+            std::static_pointer_cast<plorth::array>(value),
+            output
+          );
+
+        case plorth::value::type::object:
+          return encode_object(
+            std::static_pointer_cast<plorth::object>(value),
+            output
+          );
+
+        case plorth::value::type::symbol:
+          encode_symbol(std::static_pointer_cast<plorth::symbol>(value), output);
+          return true;
+
+        case plorth::value::type::quote:
+          return encode_quote(
+            std::static_pointer_cast<plorth::quote>(value),
+            output
+          );
+
+        case plorth::value::type::word:
+        {
+          const auto word = std::static_pointer_cast<plorth::word>(value);
+
+          write_opcode(opcode::declare_word, output);
+          encode_symbol(word->symbol(), output);
+
+          return encode_quote(word->quote(), output);
+        }
+
+        default:
+          return false;
+      }
+    }
+
+    void
+    write_symbol_map(std::vector<unsigned char>& output) const
+    {
+      io::write_uint32(output, static_cast<std::uint32_t>(m_symbols.size()));
+      for (const auto& str : m_symbols)
+      {
+        io::write_string(output, str);
+      }
+    }
+
+  private:
+    void
+    encode_number(
+      const std::shared_ptr<plorth::number>& number,
+      std::vector<unsigned char>& output
+    )
+    {
+      if (number->number_type() == plorth::number::number_type::int_type)
+      {
+        write_opcode(opcode::push_integer, output);
+        io::write_uint64(
+          output,
+          static_cast<std::uint64_t>(static_cast<std::int64_t>(number->as_int()))
+        );
+      } else {
+        const double value = number->as_real();
+        std::uint64_t bits;
+
+        static_assert(sizeof(bits) == sizeof(value));
+        std::memcpy(
+          static_cast<void*>(&bits),
+          static_cast<const void*>(&value),
+          sizeof(bits)
+        );
+        write_opcode(opcode::push_real, output);
+        io::write_uint64(output, bits);
+      }
+    }
+
+    bool
+    encode_array(
+      const std::shared_ptr<plorth::array>& array,
+      std::vector<unsigned char>& output
+    )
+    {
+      const auto size = array->size();
+
+      write_opcode(opcode::push_array, output);
+      io::write_varint(output, static_cast<std::uint32_t>(size));
+      for (plorth::array::size_type i = 0; i < size; ++i)
+      {
+        if (!encode(array->at(i), output))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    bool
+    encode_object(
+      const std::shared_ptr<plorth::object>& object,
+      std::vector<unsigned char>& output
+    )
+    {
+      const auto& entries = object->entries();
+
+      write_opcode(opcode::push_object, output);
+      io::write_varint(output, static_cast<std::uint32_t>(entries.size()));
+      for (const auto& entry : entries)
+      {
+        output.push_back(opcode::push_string_const);
+        io::write_varint(output, add_symbol(entry.first));
+        if (!encode(entry.second, output))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    void
+    encode_symbol(
+      const std::shared_ptr<plorth::symbol>& symbol,
+      std::vector<unsigned char>& output
+    )
+    {
+      write_opcode(opcode::push_symbol_const, output);
+      io::write_varint(output, add_symbol(symbol->id()));
+      if (const auto& position = symbol->position())
+      {
+        write_position(*position);
+      }
+    }
+
+    bool
+    encode_quote(
+      const std::shared_ptr<plorth::quote>& quote,
+      std::vector<unsigned char>& output
+    )
+    {
+      if (!quote || quote->quote_type() != plorth::quote::quote_type::compiled)
+      {
+        return false;
+      }
+
+      const auto& children = std::static_pointer_cast<plorth::compiled_quote>(
+        quote
+      )->children();
+
+      write_opcode(opcode::push_quote, output);
+      io::write_varint(output, static_cast<std::uint32_t>(children.size()));
+      for (const auto& child : children)
+      {
+        if (!encode(child, output))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    void
+    write_opcode(unsigned char opcode, std::vector<unsigned char>& output)
+    {
+      output.push_back(opcode);
+      ++m_instruction_count;
+    }
+
+    /**
+     * Writes source code position of the instruction which was encoded last
+     * into the debug info, in the same format as the compiler does.
+     */
+    void
+    write_position(const plorth::parser::position& position)
+    {
+      const auto instruction = m_instruction_count - 1;
+      const auto file = add_symbol(position.file);
+      const bool file_changed = !m_file || *m_file != file;
+
+      io::write_varint(
+        *m_debug_info,
+        ((instruction - m_next_instruction) << 1) | (file_changed ? 1 : 0)
+      );
+      if (file_changed)
+      {
+        io::write_varint(*m_debug_info, file);
+      }
+      io::write_svarint(
+        *m_debug_info,
+        static_cast<std::int32_t>(position.line - m_line)
+      );
+      io::write_varint(
+        *m_debug_info,
+        static_cast<std::uint32_t>(position.column)
+      );
+      m_next_instruction = instruction + 1;
+      m_file = file;
+      m_line = position.line;
+    }
+
+  private:
+    std::vector<std::u32string> m_symbols;
+    std::unordered_map<std::u32string, std::uint32_t> m_symbol_index;
+    std::vector<unsigned char>* m_debug_info;
+    std::uint32_t m_instruction_count;
+    std::uint32_t m_next_instruction;
+    std::optional<std::uint32_t> m_file;
+    int m_line;
+  };
+
+  std::optional<std::string>
+  write(const environment& environment, const std::string& path)
+  {
+    const auto& cache = environment.module_cache();
+    std::vector<std::u32string> names;
+    std::vector<std::uint32_t> name_indexes;
+    std::vector<std::vector<unsigned char>> modules;
+    std::vector<std::vector<unsigned char>> debug_infos;
+    std::vector<unsigned char> output;
+    std::uint32_t offset = 0;
+    std::uint32_t debug_offset = 0;
+    class encoder encoder;
+    FILE* file;
+    std::size_t written;
+
+    // Modules are written in the order of their names, so that the same
+    // state always results in identical snapshot.
+    for (const auto& entry : cache)
+    {
+      names.push_back(entry.first);
+    }
+    std::sort(std::begin(names), std::end(names));
+
+    for (const auto& name : names)
+    {
+      std::vector<unsigned char> module;
+      std::vector<unsigned char> debug_info;
+
+      if (encoder.encode_module(cache.at(name), module, debug_info))
+      {
+        name_indexes.push_back(encoder.add_symbol(name));
+        modules.push_back(std::move(module));
+        debug_infos.push_back(std::move(debug_info));
+      }
+    }
+
+    output.push_back('R');
+    output.push_back('j');
+    output.push_back('L');
+    output.push_back(MASIINA_VERSION_PATCH);
+    output.push_back(MASIINA_VERSION_MINOR);
+    output.push_back(MASIINA_VERSION_MAJOR);
+    output.push_back(flags::debug_info | flags::snapshot);
+    io::write_uint64(output, environment.unit_hash().value_or(0));
+    encoder.write_symbol_map(output);
+    io::write_uint32(output, static_cast<std::uint32_t>(modules.size()));
+    for (const auto& module : modules)
+    {
+      debug_offset += static_cast<std::uint32_t>(module.size());
+    }
+    for (std::size_t i = 0; i < modules.size(); ++i)
+    {
+      const auto length = static_cast<std::uint32_t>(modules[i].size());
+      const auto debug_length = static_cast<std::uint32_t>(
+        debug_infos[i].size()
+      );
+
+      io::write_uint32(output, name_indexes[i]);
+      io::write_uint32(output, offset);
+      io::write_uint32(output, length);
+      io::write_uint32(output, debug_offset);
+      io::write_uint32(output, debug_length);
+      offset += length;
+      debug_offset += debug_length;
+    }
+    for (const auto& module : modules)
+    {
+      output.insert(std::end(output), std::begin(module), std::end(module));
+    }
+    for (const auto& debug_info : debug_infos)
+    {
+      output.insert(
+        std::end(output),
+        std::begin(debug_info),
+        std::end(debug_info)
+      );
+    }
+
+    if (!(file = std::fopen(path.c_str(), "wb")))
+    {
+      return std::make_optional<std::string>(
+        "Unable to open file `"
+        + path
+        + "' for writing: "
+        + std::strerror(errno)
+      );
+    }
+    written = std::fwrite(
+      static_cast<const void*>(output.data()),
+      1,
+      output.size(),
+      file
+    );
+    if (std::fclose(file) || written != output.size())
+    {
+      return std::make_optional<std::string>(
+        "Unable to write snapshot into `"
+        + path
+        + "': "
+        + std::strerror(errno)
+      );
+    }
+
+    return std::nullopt;
+  }
+}
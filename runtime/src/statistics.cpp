@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <iomanip>
+
+#include <masiina/runtime/config.hpp>
+#include <masiina/runtime/parser.hpp>
+#include <masiina/runtime/statistics.hpp>
+#include <peelo/unicode/encoding/utf8.hpp>
+
+#if defined(HAVE_GETRUSAGE)
+# include <sys/resource.h>
+#endif
+
+namespace masiina::runtime
+{
+  static void
+  print_duration(std::ostream& output, statistics::duration_type duration)
+  {
+    const auto microseconds = std::chrono::duration_cast<
+      std::chrono::microseconds
+    >(duration).count();
+
+    output
+      << microseconds / 1000
+      << "."
+      << std::setw(3)
+      << std::setfill('0')
+      << microseconds % 1000
+      << std::setfill(' ')
+      << " ms";
+  }
+
+  void
+  print_statistics(std::ostream& output, const statistics& statistics)
+  {
+    output
+      << "Modules loaded:     " << statistics.modules_loaded << std::endl
+      << "Modules imported:   " << statistics.modules_imported << std::endl
+      << "Values decoded:     " << parser::decoded_value_count() << std::endl
+      << "Load time:          ";
+    print_duration(output, statistics.load_time);
+    output
+      << std::endl
+      << "Routine steps:      " << statistics.steps << std::endl
+      << "Routines spawned:   " << statistics.routines_spawned << std::endl
+      << "Routines finished:  " << statistics.routines_finished << std::endl
+      << "Peak live routines: " << statistics.peak_live_routines << std::endl;
+#if defined(HAVE_GETRUSAGE)
+    struct rusage usage;
+
+    // Plorth's memory manager doesn't keep track of it's peak usage, so the
+    // peak resident set size of the whole process is used instead.
+    if (!getrusage(RUSAGE_SELF, &usage))
+    {
+      output << "Peak memory:        " << usage.ru_maxrss << " KiB" << std::endl;
+    }
+#endif
+    for (const auto& import_time : statistics.import_times)
+    {
+      output
+        << "Import of `"
+        << peelo::unicode::encoding::utf8::encode(import_time.first)
+        << "': ";
+      print_duration(output, import_time.second);
+      output << std::endl;
+    }
+  }
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <limits>
+
+#include <masiina/runtime/timer_wheel.hpp>
+
+namespace masiina::runtime
+{
+  timer_wheel::timer_wheel()
+    : m_start(clock::now())
+    , m_current_tick(0)
+    , m_size(0) {}
+
+  void
+  timer_wheel::add(
+    clock::time_point deadline,
+    const std::shared_ptr<routine>& routine
+  )
+  {
+    insert({ to_tick(deadline), routine });
+    ++m_size;
+  }
+
+  std::vector<std::shared_ptr<routine>>
+  timer_wheel::advance(clock::time_point now)
+  {
+    const auto target = to_tick(now);
+    std::vector<std::shared_ptr<routine>> expired;
+
+    // There is nothing to expire, so the wheel can be moved to given time
+    // directly.
+    if (!m_size)
+    {
+      m_current_tick = std::max(m_current_tick, target);
+
+      return expired;
+    }
+
+    while (m_current_tick < target)
+    {
+      slot_type slot;
+      std::size_t index;
+
+      // Ticks on which no slot of any level would be processed are skipped,
+      // so that advancing after a long idle wait doesn't have to step
+      // through every millisecond of it.
+      m_current_tick = std::min(target, next_tick()) - 1;
+      index = ++m_current_tick & (slot_count - 1);
+
+      // When the lowest level wraps around, timers from the next slot of
+      // upper levels are moved down.
+      if (!index)
+      {
+        cascade(1);
+      }
+
+      slot.swap(m_levels[0][index]);
+      for (auto& timer : slot)
+      {
+        if (timer.expiry <= m_current_tick)
+        {
+          expired.push_back(std::move(timer.routine));
+          --m_size;
+        } else {
+          insert(std::move(timer));
+        }
+      }
+    }
+
+    return expired;
+  }
+
+  std::optional<timer_wheel::clock::time_point>
+  timer_wheel::next_deadline()
+  {
+    std::optional<std::uint64_t> earliest;
+
+    if (!m_size)
+    {
+      return std::nullopt;
+    }
+
+    // Timers of each level are in slots ordered by their deadline, starting
+    // from the slot after the current one, so only the first non-empty slot
+    // of each level needs to be inspected. The exception is the topmost
+    // level, as timers beyond it's range are kept in whichever slot was
+    // last when they were inserted, so all of it's slots are inspected.
+    for (std::size_t level = 0; level < level_count; ++level)
+    {
+      const auto shift = level * slot_bits;
+
+      for (std::size_t i = 1; i <= slot_count; ++i)
+      {
+        const auto& slot = m_levels[level][
+          ((m_current_tick >> shift) + i) & (slot_count - 1)
+        ];
+
+        if (slot.empty())
+        {
+          continue;
+        }
+        for (const auto& timer : slot)
+        {
+          if (!earliest || timer.expiry < *earliest)
+          {
+            earliest = timer.expiry;
+          }
+        }
+        if (level + 1 < level_count)
+        {
+          break;
+        }
+      }
+    }
+
+    if (!earliest)
+    {
+      return std::nullopt;
+    }
+
+    return m_start + std::chrono::milliseconds(*earliest);
+  }
+
+  std::uint64_t
+  timer_wheel::next_tick() const
+  {
+    auto next = std::numeric_limits<std::uint64_t>::max();
+
+    // Slot of an upper level is processed when the wheel reaches the first
+    // tick of the period covered by it, which is also when all the levels
+    // below it wrap around.
+    for (std::size_t level = 0; level < level_count; ++level)
+    {
+      const auto shift = level * slot_bits;
+
+      for (std::size_t i = 1; i <= slot_count; ++i)
+      {
+        const auto position = (m_current_tick >> shift) + i;
+
+        if (!m_levels[level][position & (slot_count - 1)].empty())
+        {
+          next = std::min(next, position << shift);
+          break;
+        }
+      }
+    }
+
+    return next;
+  }
+
+  std::uint64_t
+  timer_wheel::to_tick(clock::time_point time) const
+  {
+    if (time <= m_start)
+    {
+      return 0;
+    }
+
+    // Round up, so that timers never expire before their deadline.
+    const auto elapsed = time - m_start;
+    const auto ticks = std::chrono::duration_cast<std::chrono::milliseconds>(
+      elapsed
+    );
+
+    return static_cast<std::uint64_t>(ticks.count())
+      + (ticks < elapsed ? 1 : 0);
+  }
+
+  void
+  timer_wheel::insert(timer&& timer)
+  {
+    const auto delta = timer.expiry > m_current_tick
+      ? timer.expiry - m_current_tick
+      : 1;
+    std::size_t level = 0;
+
+    while (level + 1 < level_count
+           && delta >= (std::uint64_t(1) << (slot_bits * (level + 1))))
+    {
+      ++level;
+    }
+
+    // Timers beyond range of the topmost level are placed in it's last slot,
+    // from which they are inserted again as the wheel advances.
+    auto expiry = std::max(timer.expiry, m_current_tick + 1);
+    const auto range = std::uint64_t(1) << (slot_bits * level_count);
+
+    if (delta >= range)
+    {
+      expiry = m_current_tick + range - 1;
+    }
+
+    m_levels[level][
+      (expiry >> (slot_bits * level)) & (slot_count - 1)
+    ].push_back(std::move(timer));
+  }
+
+  void
+  timer_wheel::cascade(std::size_t level)
+  {
+    const auto index = (m_current_tick >> (slot_bits * level))
+      & (slot_count - 1);
+    slot_type slot;
+
+    if (level >= level_count)
+    {
+      return;
+    }
+    if (!index)
+    {
+      cascade(level + 1);
+    }
+    slot.swap(m_levels[level][index]);
+    for (auto& timer : slot)
+    {
+      // Timers which expire on the current tick go to the slot which is
+      // about to be expired.
+      if (timer.expiry <= m_current_tick)
+      {
+        m_levels[0][m_current_tick & (slot_count - 1)].push_back(
+          std::move(timer)
+        );
+      } else {
+        insert(std::move(timer));
+      }
+    }
+  }
+}
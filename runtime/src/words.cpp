@@ -0,0 +1,590 @@
+/*
+ * Copyright (c) 2022, Rauli Laine
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <masiina/runtime/channel.hpp>
+#include <masiina/runtime/environment.hpp>
+#include <masiina/runtime/routine.hpp>
+#include <masiina/runtime/words.hpp>
+#include <peelo/unicode/encoding/utf8.hpp>
+
+namespace masiina::runtime
+{
+  /**
+   * Word: yield
+   *
+   * Ends current turn of the routine, giving way to other routines.
+   */
+  static void
+  w_yield(const std::shared_ptr<plorth::context>&)
+  {
+    if (const auto routine = routine::current())
+    {
+      routine->yield();
+    }
+  }
+
+  /**
+   * Pops an object from the stack of given context and calls it's method
+   * with given name in the context. Routines and channels are represented
+   * by objects which carry their operations as native quotes, so that they
+   * are released once they are no longer referenced.
+   */
+  static void
+  call_method(
+    const std::shared_ptr<plorth::context>& context,
+    const std::u32string& name,
+    const std::u32string& description
+  )
+  {
+    std::shared_ptr<plorth::value> value;
+
+    if (!context->pop(value))
+    {
+      return;
+    }
+    if (value && value->type() == plorth::value::type::object)
+    {
+      const auto object = std::static_pointer_cast<plorth::object>(value);
+
+      for (const auto& entry : object->entries())
+      {
+        if (entry.first == name
+            && entry.second
+            && entry.second->type() == plorth::value::type::quote)
+        {
+          std::static_pointer_cast<plorth::quote>(entry.second)->call(context);
+          return;
+        }
+      }
+    }
+    context->error(
+      plorth::error::code::type,
+      U"Expected " + description + U"."
+    );
+  }
+
+  /**
+   * Returns an object which represents given routine in Plorth code.
+   */
+  static std::shared_ptr<plorth::object>
+  make_routine_object(
+    const std::shared_ptr<plorth::runtime>& runtime,
+    const std::shared_ptr<routine>& joined
+  )
+  {
+    return runtime->object({
+      {
+        U"join",
+        runtime->native_quote(
+          [joined](const std::shared_ptr<plorth::context>& context)
+          {
+            const auto current = routine::current();
+
+            if (!current)
+            {
+              context->error(
+                plorth::error::code::value,
+                U"Routines can only be joined from another routine."
+              );
+              return;
+            }
+            else if (joined.get() == current)
+            {
+              context->error(
+                plorth::error::code::value,
+                U"Routine cannot join itself."
+              );
+              return;
+            }
+
+            joined->wait(*current);
+
+            if (const auto& error = joined->error())
+            {
+              context->error(error);
+              return;
+            }
+
+            const auto& data = joined->context()->data();
+
+            context->push(context->runtime()->array(data.data(), data.size()));
+          }
+        )
+      },
+    });
+  }
+
+  static void
+  spawn_quote(
+    const std::shared_ptr<plorth::context>& context,
+    const std::shared_ptr<plorth::quote>& quote,
+    const std::shared_ptr<plorth::context>& routine_context
+  )
+  {
+    const auto& runtime = context->runtime();
+    const auto current = routine::current();
+
+    if (!current)
+    {
+      context->error(
+        plorth::error::code::value,
+        U"Routines can only be spawned from another routine."
+      );
+      return;
+    }
+
+    // Words defined by the spawning routine are visible to the spawned
+    // one, so that the quote can call them.
+    for (const auto& word : context->dictionary().words())
+    {
+      routine_context->dictionary().insert(word);
+    }
+
+    const auto routine = current->environment().spawn(
+      { quote, runtime->symbol(U"call") },
+      routine_context
+    );
+
+    context->push(make_routine_object(runtime, routine));
+  }
+
+  /**
+   * Word: spawn
+   *
+   * Takes:
+   * - quote
+   *
+   * Gives:
+   * - object
+   *
+   * Creates new routine which calls given quote with an empty stack, and
+   * returns an object representing the routine. The routine runs
+   * concurrently with the calling one, and it's results can be retrieved
+   * with `join`.
+   */
+  static void
+  w_spawn(const std::shared_ptr<plorth::context>& context)
+  {
+    std::shared_ptr<plorth::quote> quote;
+
+    if (context->pop_quote(quote))
+    {
+      spawn_quote(
+        context,
+        quote,
+        plorth::context::make(context->runtime())
+      );
+    }
+  }
+
+  /**
+   * Word: spawn-with
+   *
+   * Takes:
+   * - array
+   * - quote
+   *
+   * Gives:
+   * - object
+   *
+   * Creates new routine which calls given quote with elements of the given
+   * array on it's stack, and returns an object representing the routine.
+   */
+  static void
+  w_spawn_with(const std::shared_ptr<plorth::context>& context)
+  {
+    std::shared_ptr<plorth::quote> quote;
+    std::shared_ptr<plorth::array> arguments;
+
+    if (!context->pop_quote(quote) || !context->pop_array(arguments))
+    {
+      return;
+    }
+
+    const auto routine_context = plorth::context::make(context->runtime());
+
+    for (std::size_t i = 0; i < arguments->size(); ++i)
+    {
+      routine_context->push(arguments->at(i));
+    }
+
+    spawn_quote(context, quote, routine_context);
+  }
+
+  /**
+   * Word: join
+   *
+   * Takes:
+   * - object
+   *
+   * Gives:
+   * - array
+   *
+   * Waits until given routine has finished and returns contents of it's
+   * stack as an array. The calling routine is parked while it's waiting. If
+   * the routine failed, it's error is propagated to the calling routine.
+   */
+  static void
+  w_join(const std::shared_ptr<plorth::context>& context)
+  {
+    call_method(context, U"join", U"routine");
+  }
+
+  /**
+   * Returns an object which represents given channel in Plorth code.
+   */
+  static std::shared_ptr<plorth::object>
+  make_channel_object(
+    const std::shared_ptr<plorth::runtime>& runtime,
+    const std::shared_ptr<channel>& channel
+  )
+  {
+    return runtime->object({
+      {
+        U"send",
+        runtime->native_quote(
+          [channel](const std::shared_ptr<plorth::context>& context)
+          {
+            const auto current = routine::current();
+            std::shared_ptr<plorth::value> value;
+
+            if (!current)
+            {
+              context->error(
+                plorth::error::code::value,
+                U"Values can only be sent to an channel from an routine."
+              );
+            }
+            else if (context->pop(value))
+            {
+              channel->send(*current, value);
+            }
+          }
+        )
+      },
+      {
+        U"receive",
+        runtime->native_quote(
+          [channel](const std::shared_ptr<plorth::context>& context)
+          {
+            const auto current = routine::current();
+
+            if (!current)
+            {
+              context->error(
+                plorth::error::code::value,
+                U"Values can only be received from an channel in an routine."
+              );
+              return;
+            }
+            context->push(channel->receive(*current));
+          }
+        )
+      },
+      {
+        U"close",
+        runtime->native_quote(
+          [channel](const std::shared_ptr<plorth::context>&)
+          {
+            channel->close();
+          }
+        )
+      },
+    });
+  }
+
+  /**
+   * Word: channel
+   *
+   * Takes:
+   * - number
+   *
+   * Gives:
+   * - object
+   *
+   * Creates new channel which can buffer given number of values, and
+   * returns an object representing the channel.
+   */
+  static void
+  w_channel(const std::shared_ptr<plorth::context>& context)
+  {
+    const auto current = routine::current();
+    std::shared_ptr<plorth::number> capacity;
+
+    if (!context->pop_number(capacity))
+    {
+      return;
+    }
+    else if (capacity->as_int() < 1)
+    {
+      context->error(
+        plorth::error::code::range,
+        U"Capacity of an channel must be greater than zero."
+      );
+      return;
+    }
+    else if (!current)
+    {
+      context->error(
+        plorth::error::code::value,
+        U"Channels can only be created from an routine."
+      );
+      return;
+    }
+
+    context->push(make_channel_object(
+      context->runtime(),
+      std::make_shared<channel>(
+        current->environment(),
+        static_cast<std::size_t>(capacity->as_int())
+      )
+    ));
+  }
+
+  /**
+   * Word: send
+   *
+   * Takes:
+   * - any
+   * - object
+   *
+   * Sends given value into given channel. If the channel is full, the
+   * calling routine is parked until there is room in it.
+   */
+  static void
+  w_send(const std::shared_ptr<plorth::context>& context)
+  {
+    call_method(context, U"send", U"channel");
+  }
+
+  /**
+   * Word: receive
+   *
+   * Takes:
+   * - object
+   *
+   * Gives:
+   * - any
+   *
+   * Receives value from given channel. If the channel is empty, the calling
+   * routine is parked until an value has been sent into it. Null is
+   * returned once the channel has been closed and drained.
+   */
+  static void
+  w_receive(const std::shared_ptr<plorth::context>& context)
+  {
+    call_method(context, U"receive", U"channel");
+  }
+
+  /**
+   * Word: close
+   *
+   * Takes:
+   * - object
+   *
+   * Closes given channel. Routines waiting to receive from the channel are
+   * given null once it has been drained, and sending into it is an error.
+   */
+  static void
+  w_close(const std::shared_ptr<plorth::context>& context)
+  {
+    call_method(context, U"close", U"channel");
+  }
+
+  static bool
+  is_readable(int fd)
+  {
+    struct pollfd descriptor = {};
+
+    descriptor.fd = fd;
+    descriptor.events = POLLIN;
+
+    return ::poll(&descriptor, 1, 0) != 0;
+  }
+
+  /**
+   * Word: read-line
+   *
+   * Takes:
+   * - number
+   *
+   * Gives:
+   * - string|null
+   *
+   * Reads line from file descriptor with given number and returns it
+   * without the terminating new line. The calling routine is parked until
+   * the descriptor has input available, so that other routines can run in
+   * the meantime. Null is returned when the end of input has been reached.
+   */
+  static void
+  w_read_line(const std::shared_ptr<plorth::context>& context)
+  {
+    const auto current = routine::current();
+    std::shared_ptr<plorth::number> number;
+    int fd;
+
+    if (!context->pop_number(number))
+    {
+      return;
+    }
+    else if (!current || number->as_int() < 0)
+    {
+      context->error(plorth::error::code::range, U"Invalid file descriptor.");
+      return;
+    }
+
+    auto& environment = current->environment();
+
+    fd = static_cast<int>(number->as_int());
+    for (;;)
+    {
+      auto& buffer = environment.input_buffers()[fd];
+      const auto newline = buffer.find('\n');
+      char chunk[4096];
+      ssize_t read;
+
+      if (newline != std::string::npos)
+      {
+        context->push(context->runtime()->string(
+          peelo::unicode::encoding::utf8::decode(buffer.data(), newline)
+        ));
+        buffer.erase(0, newline + 1);
+        return;
+      }
+
+      if (environment.reactor().is_supported() && !is_readable(fd))
+      {
+        if (!environment.reactor().wait(*current, fd, reactor::interest::read))
+        {
+          context->error(
+            plorth::error::code::io,
+            peelo::unicode::encoding::utf8::decode(std::strerror(errno))
+          );
+          return;
+        }
+        continue;
+      }
+
+      if ((read = ::read(fd, chunk, sizeof(chunk))) > 0)
+      {
+        buffer.append(chunk, static_cast<std::size_t>(read));
+      }
+      else if (!read)
+      {
+        // End of input has been reached, so return what's left in the
+        // buffer, or null if there is nothing.
+        if (buffer.empty())
+        {
+          context->push(nullptr);
+        } else {
+          context->push(context->runtime()->string(
+            peelo::unicode::encoding::utf8::decode(buffer)
+          ));
+        }
+        environment.input_buffers().erase(fd);
+        return;
+      }
+      else if (errno != EINTR && errno != EAGAIN)
+      {
+        context->error(
+          plorth::error::code::io,
+          peelo::unicode::encoding::utf8::decode(std::strerror(errno))
+        );
+        return;
+      }
+    }
+  }
+
+  /**
+   * Word: sleep
+   *
+   * Takes:
+   * - number
+   *
+   * Parks the calling routine for given number of milliseconds, allowing
+   * other routines to run in the meantime. Zero or negative duration just
+   * ends the current turn of the routine.
+   */
+  static void
+  w_sleep(const std::shared_ptr<plorth::context>& context)
+  {
+    const auto current = routine::current();
+    std::shared_ptr<plorth::number> duration;
+
+    if (!context->pop_number(duration))
+    {
+      return;
+    }
+    else if (!current)
+    {
+      context->error(
+        plorth::error::code::value,
+        U"Only routines can sleep."
+      );
+      return;
+    }
+    else if (duration->as_int() <= 0)
+    {
+      current->yield();
+      return;
+    }
+    current->environment().sleep(
+      *current,
+      std::chrono::milliseconds(duration->as_int())
+    );
+  }
+
+  void
+  register_words(const std::shared_ptr<plorth::runtime>& runtime)
+  {
+    static const std::pair<const char32_t*, plorth::quote::callback> words[] =
+    {
+      { U"channel", w_channel },
+      { U"close", w_close },
+      { U"join", w_join },
+      { U"read-line", w_read_line },
+      { U"receive", w_receive },
+      { U"send", w_send },
+      { U"sleep", w_sleep },
+      { U"spawn", w_spawn },
+      { U"spawn-with", w_spawn_with },
+      { U"yield", w_yield },
+    };
+
+    for (const auto& word : words)
+    {
+      runtime->dictionary().insert(runtime->word(
+        runtime->symbol(word.first),
+        runtime->native_quote(word.second)
+      ));
+    }
+  }
+}